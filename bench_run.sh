@@ -0,0 +1,32 @@
+#!/bin/sh
+
+# Build and run the benchmarks (no devices or root needed, everything goes
+# through pipes)
+
+# Files
+src_daemon="c_src/simul_daemon.c c_src/chord.c c_src/keymap.c"
+out_daemon="out_simul_daemon"
+src_keymap="c_src/simul_keymap.c c_src/chord.c c_src/keymap.c"
+out_keymap="out_simul_keymap"
+src_bench_startup="c_src/bench_startup.c"
+out_bench_startup="out_bench_startup"
+src_bench_daemon="c_src/bench_daemon.c"
+out_bench_daemon="out_bench_daemon"
+src_bench_engine="c_src/bench_engine.c c_src/chord.c c_src/simulkeys.c"
+out_bench_engine="out_bench_engine"
+src_bench_evbatch="c_src/bench_evbatch.c"
+out_bench_evbatch="out_bench_evbatch"
+
+# Build and run
+gcc -O2 $src_daemon -lpthread -o $out_daemon && \
+gcc -O2 $src_bench_daemon -lpthread -o $out_bench_daemon && \
+./"$out_bench_daemon" ./"$out_daemon" && \
+gcc -O2 $src_keymap -o $out_keymap && \
+./"$out_keymap" out_keymap.bin > /dev/null && \
+gcc -O2 $src_bench_startup -o $out_bench_startup && \
+./"$out_bench_startup" 200 ./"$out_daemon" && \
+./"$out_bench_startup" 200 ./"$out_daemon" -k out_keymap.bin && \
+gcc -O2 $src_bench_engine -o $out_bench_engine && \
+./"$out_bench_engine" && \
+gcc -O2 $src_bench_evbatch -o $out_bench_evbatch && \
+./"$out_bench_evbatch"
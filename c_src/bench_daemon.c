@@ -0,0 +1,159 @@
+#define _GNU_SOURCE
+#include <linux/input.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "daemon_harness.h"
+
+// Benchmark for `simul_daemon` reading from stdin: single threaded epoll loop
+// vs. the two thread (`-t`) layout. Every mode gets:
+// - burst: all frames written as fast as the pipe takes them (throughput)
+// - paced: one frame every PACED_INTERVAL_NS (latency while mostly idle)
+// Latency is measured on pass-through keys, their event time is set to the
+// moment they are written and comes back out of the daemon unchanged.
+//
+// usage: bench_daemon DAEMON_BINARY [FRAMES]
+
+#define DEFAULT_FRAMES 200000
+#define PACED_FRAMES 5000
+#define PACED_INTERVAL_NS 200000  // 0.2ms, 5000 frames/s
+#define CHUNK_FRAMES 64
+#define FRAME_EVENTS 2  // Key event + SYN_REPORT
+
+struct run {
+    const char *daemon;
+    const char *flag;  // NULL for the default single thread mode
+    size_t frames;
+    uint64_t interval_ns;  // 0 for burst
+    int in_fd;
+    uint64_t *latencies;
+    size_t num_latencies;
+};
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void sleep_until(uint64_t t) {
+    struct timespec ts = {.tv_sec = t / 1000000000, .tv_nsec = t % 1000000000};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+// Mostly non-source keys, with every 8th frame a lone source key (J) so the
+// chord engine has some holding back to do as well
+static void make_frame(struct input_event *ev, size_t i, uint64_t now) {
+    const struct timeval tv = {.tv_sec  = now / 1000000000,
+                               .tv_usec = (now % 1000000000) / 1000};
+    ev[0] = (struct input_event){.time  = tv,
+                                 .type  = EV_KEY,
+                                 .code  = (i / 2) % 8 == 7 ? KEY_J : KEY_A,
+                                 .value = !(i & 1)};
+    ev[1] = (struct input_event){
+        .time = tv, .type = EV_SYN, .code = SYN_REPORT, .value = 0};
+}
+
+static void *writer(void *arg) {
+    struct run *r = arg;
+    struct input_event chunk[CHUNK_FRAMES * FRAME_EVENTS];
+    const uint64_t start = now_ns();
+    size_t i             = 0;
+    while (i < r->frames) {
+        size_t n = r->interval_ns ? 1 : CHUNK_FRAMES;
+        if (n > r->frames - i)
+            n = r->frames - i;
+        if (r->interval_ns)
+            sleep_until(start + i * r->interval_ns);
+        const uint64_t now = now_ns();
+        size_t j;
+        for (j = 0; j < n; j++)
+            make_frame(&chunk[j * FRAME_EVENTS], i + j, now);
+        if (write(r->in_fd, chunk, n * FRAME_EVENTS * sizeof(chunk[0])) == -1)
+            err_exit("Failed on write");
+        i += n;
+    }
+    close(r->in_fd);
+    return NULL;
+}
+
+static pid_t spawn(struct run *r, int *out_fd) {
+    char *argv[] = {(char *)r->daemon, (char *)r->flag};
+    char *args[4];
+    daemon_args(args, argv, r->flag ? 2 : 1);
+    return spawn_daemon(args, &r->in_fd, out_fd, NULL);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void run(struct run *r, const char *name) {
+    int out_fd;
+    pid_t pid = spawn(r, &out_fd);
+    r->latencies     = malloc(r->frames * sizeof(uint64_t));
+    r->num_latencies = 0;
+
+    pthread_t tid;
+    const uint64_t start = now_ns();
+    if (pthread_create(&tid, NULL, writer, r) != 0)
+        err_exit("Failed on pthread_create");
+
+    struct input_event events[256];
+    size_t total = 0, partial = 0;
+    ssize_t n;
+    while ((n = read(out_fd, (char *)events + partial,
+                     sizeof(events) - partial)) > 0) {
+        const uint64_t now = now_ns();
+        const size_t count = (partial + n) / sizeof(events[0]);
+        size_t i;
+        for (i = 0; i < count; i++) {
+            if (events[i].type == EV_KEY && events[i].code == KEY_A)
+                r->latencies[r->num_latencies++] =
+                    now - ((uint64_t)events[i].time.tv_sec * 1000000000 +
+                           events[i].time.tv_usec * 1000);
+        }
+        total += count;
+        partial = (partial + n) % sizeof(events[0]);
+        memmove(events, (char *)(events + count), partial);
+    }
+    const uint64_t elapsed = now_ns() - start;
+    pthread_join(tid, NULL);
+    reap_daemon(pid, -1, out_fd);
+
+    qsort(r->latencies, r->num_latencies, sizeof(uint64_t), cmp_u64);
+    const size_t m = r->num_latencies;
+    printf("%-8s %-6s %10.0f events/s  latency p50 %8.1fus  p99 %8.1fus  "
+           "max %8.1fus\n",
+           r->flag ? r->flag : "single", name, total * 1e9 / elapsed,
+           m ? r->latencies[m / 2] / 1e3 : 0.0,
+           m ? r->latencies[m * 99 / 100] / 1e3 : 0.0,
+           m ? r->latencies[m - 1] / 1e3 : 0.0);
+    free(r->latencies);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s DAEMON_BINARY [FRAMES]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const size_t frames = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_FRAMES;
+    const char *flags[] = {NULL, "-t"};
+    size_t f;
+    for (f = 0; f < sizeof(flags) / sizeof(flags[0]); f++) {
+        struct run burst = {.daemon = argv[1], .flag = flags[f],
+                            .frames = frames};
+        run(&burst, "burst");
+        struct run paced = {.daemon      = argv[1],
+                            .flag        = flags[f],
+                            .frames      = PACED_FRAMES,
+                            .interval_ns = PACED_INTERVAL_NS};
+        run(&paced, "paced");
+    }
+}
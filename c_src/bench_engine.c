@@ -0,0 +1,139 @@
+#include <linux/input.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "chord.h"
+#include "chord_rules.h"
+#include "chord_static.h"
+#include "simulkeys.h"
+
+// Benchmark for the chord engine alone, no I/O: the runtime (table driven)
+// engine of `chord.c` vs. the same engine specialized for the rules of
+// `chord_rules.h` at compile time (`chord_static.h`). Both get the same
+// pseudo random stream of key frames on a virtual clock, and their output is
+// checksummed to make sure they agree. libsimulkeys (`simulkeys.h`) is run
+// on the same stream as well, one frame per `simulkeys_feed` call.
+//
+// usage: bench_engine [FRAMES]
+
+#define DEFAULT_FRAMES 20000000
+#define ROUNDS 5
+#define FRAME_EVENTS 2  // Key event + SYN_REPORT
+
+CHORD_STATIC_ENGINE(simul, SIMUL_THRESHOLD, SIMUL_RULES)
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Mostly J/K (chords, taps, swallowed presses) mixed with other keys, gaps
+// of 0-64ms so some presses run past the threshold
+static void make_stream(struct input_event *events, uint64_t *times,
+                        size_t frames) {
+    const uint16_t codes[] = {KEY_J, KEY_K, KEY_J, KEY_K, KEY_A, KEY_S};
+    uint64_t seed = 1, t = 0;
+    size_t i;
+    for (i = 0; i < frames; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        t += (seed >> 33) % 64000000;
+        times[i]            = t;
+        const uint16_t code = codes[(seed >> 20) % 6];
+        const int32_t value = (seed >> 40) % 3 ? 1 : 0;
+        events[i * 2] = (struct input_event){
+            .type = EV_KEY, .code = code, .value = value};
+        events[i * 2 + 1] = (struct input_event){
+            .type = EV_SYN, .code = SYN_REPORT, .value = 0};
+    }
+}
+
+static inline uint64_t checksum(uint64_t sum, const struct input_event *out,
+                                size_t n) {
+    size_t i;
+    for (i = 0; i < n; i++)
+        sum = sum * 31 + ((uint64_t)out[i].code << 8 | out[i].value);
+    return sum;
+}
+
+int main(int argc, char *argv[]) {
+    const size_t frames = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_FRAMES;
+    struct input_event *events =
+        malloc(frames * FRAME_EVENTS * sizeof(struct input_event));
+    uint64_t *times = malloc(frames * sizeof(uint64_t));
+    if (!events || !times) {
+        fprintf(stderr, "Failed on malloc\n");
+        return EXIT_FAILURE;
+    }
+    make_stream(events, times, frames);
+
+    static struct chord_config cfg;
+    chord_config_init(&cfg);
+    struct input_event out[CHORD_MAX_OUT];
+    struct simulkeys *sk = simulkeys_new(NULL, 0, 0);
+    struct input_event lib_out[SIMULKEYS_OUT_MAX(FRAME_EVENTS)];
+    uint64_t best_runtime = UINT64_MAX, best_static = UINT64_MAX,
+             best_lib     = UINT64_MAX;
+    uint64_t sum_runtime = 0, sum_static = 0, sum_lib = 0;
+    int round;
+    for (round = 0; round < ROUNDS; round++) {
+        struct chord_state st;
+        size_t i;
+
+        chord_state_init(&st);
+        sum_runtime   = 0;
+        uint64_t start = now_ns();
+        for (i = 0; i < frames * FRAME_EVENTS; i++)
+            sum_runtime = checksum(
+                sum_runtime, out,
+                chord_feed(&cfg, &st, &events[i], times[i / 2], out));
+        uint64_t elapsed = now_ns() - start;
+        if (elapsed < best_runtime)
+            best_runtime = elapsed;
+
+        chord_state_init(&st);
+        sum_static = 0;
+        start      = now_ns();
+        for (i = 0; i < frames * FRAME_EVENTS; i++)
+            sum_static = checksum(
+                sum_static, out,
+                simul_feed(&st, &events[i], times[i / 2], out));
+        elapsed = now_ns() - start;
+        if (elapsed < best_static)
+            best_static = elapsed;
+
+        simulkeys_reset(sk, lib_out);
+        sum_lib = 0;
+        start   = now_ns();
+        for (i = 0; i < frames; i++) {
+            // Deadline timer, the engines above expire lazily on feed
+            if (simulkeys_next_deadline(sk) <= times[i])
+                sum_lib = checksum(
+                    sum_lib, lib_out,
+                    simulkeys_on_deadline(sk, times[i], lib_out));
+            sum_lib = checksum(sum_lib, lib_out,
+                               simulkeys_feed(sk, &events[i * FRAME_EVENTS],
+                                              FRAME_EVENTS, times[i],
+                                              lib_out));
+        }
+        elapsed = now_ns() - start;
+        if (elapsed < best_lib)
+            best_lib = elapsed;
+    }
+
+    const double total = frames * FRAME_EVENTS * 1e9;
+    printf("runtime  %12.0f events/s\n", total / best_runtime);
+    printf("static   %12.0f events/s (%.2fx)\n", total / best_static,
+           (double)best_runtime / best_static);
+    printf("library  %12.0f events/s\n", total / best_lib);
+    simulkeys_free(sk);
+    free(events);
+    free(times);
+    if (sum_runtime != sum_static || sum_runtime != sum_lib) {
+        fprintf(stderr, "Engines disagree on the output\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,112 @@
+#include <linux/input.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "evbatch.h"
+
+// Microbenchmark for the batch scanners of `evbatch.h` on a mouse-heavy
+// stream: pointer motion frames (REL_X, REL_Y, SYN) with a non-source key
+// frame every 16th frame and a source key (J) frame every 256th. Every
+// scanner walks the whole buffer run by run, the same way the daemon splits
+// a read batch into forwarded runs and engine events.
+//
+// usage: bench_evbatch [EVENTS]
+
+#define DEFAULT_EVENTS 40000  // ~1MB, stays in cache like a stream of reads
+#define ROUNDS 200
+
+typedef size_t (*scanner)(const struct input_event *, size_t,
+                          const struct evbatch_keyset *);
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static size_t skip_non_key(const struct input_event *events, size_t count,
+                           const struct evbatch_keyset *set) {
+    (void)set;  // Same signature as the source key scanners
+    return evbatch_skip_non_key(events, count);
+}
+
+static void make_stream(struct input_event *events, size_t count) {
+    size_t i, frame = 0;
+    for (i = 0; i + 3 <= count; i += 3, frame++) {
+        if (frame % 256 == 255) {
+            events[i]     = (struct input_event){.type = EV_KEY, .code = KEY_J,
+                                                 .value = frame / 256 & 1};
+            events[i + 1] = (struct input_event){.type = EV_MSC,
+                                                 .code = MSC_SCAN};
+        } else if (frame % 16 == 15) {
+            events[i]     = (struct input_event){.type = EV_KEY, .code = KEY_A,
+                                                 .value = frame / 16 & 1};
+            events[i + 1] = (struct input_event){.type = EV_MSC,
+                                                 .code = MSC_SCAN};
+        } else {
+            events[i] = (struct input_event){
+                .type = EV_REL, .code = REL_X, .value = 1};
+            events[i + 1] = (struct input_event){
+                .type = EV_REL, .code = REL_Y, .value = -1};
+        }
+        events[i + 2] = (struct input_event){.type = EV_SYN,
+                                             .code = SYN_REPORT};
+    }
+    for (; i < count; i++)
+        events[i] = (struct input_event){.type = EV_SYN, .code = SYN_REPORT};
+}
+
+// Number of events left for the engine, same for every correct scanner
+static size_t walk(scanner scan, const struct input_event *events,
+                   size_t count, const struct evbatch_keyset *set) {
+    size_t i = 0, stops = 0;
+    while (i < count) {
+        i += scan(events + i, count - i, set);
+        if (i < count) {
+            stops++;
+            i++;
+        }
+    }
+    return stops;
+}
+
+static void bench(const char *name, scanner scan,
+                  const struct input_event *events, size_t count,
+                  const struct evbatch_keyset *set) {
+    uint64_t best = UINT64_MAX;
+    size_t stops  = 0;
+    int round;
+    for (round = 0; round < ROUNDS; round++) {
+        const uint64_t start = now_ns();
+        stops                = walk(scan, events, count, set);
+        const uint64_t elapsed = now_ns() - start;
+        if (elapsed < best)
+            best = elapsed;
+    }
+    printf("%-12s %12.0f events/s, %zu events left for the engine\n", name,
+           count * 1e9 / best, stops);
+}
+
+int main(int argc, char *argv[]) {
+    const size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_EVENTS;
+    struct input_event *events = malloc(count * sizeof(struct input_event));
+    if (!events) {
+        fprintf(stderr, "Failed on malloc\n");
+        return EXIT_FAILURE;
+    }
+    make_stream(events, count);
+    struct evbatch_keyset set;
+    evbatch_keyset_clear(&set);
+    evbatch_keyset_add(&set, KEY_J);
+    evbatch_keyset_add(&set, KEY_K);
+
+    bench("non-key", skip_non_key, events, count, &set);
+    bench("scalar", evbatch_skip_non_source_scalar, events, count, &set);
+#ifdef EVBATCH_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        bench("avx2", evbatch_skip_non_source_avx2, events, count, &set);
+#endif
+    free(events);
+}
@@ -0,0 +1,93 @@
+#define _GNU_SOURCE
+#include <linux/input.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "daemon_harness.h"
+
+// Start up benchmark for `simul_daemon` (or any filter reading stdin): how
+// long from starting the process until it is passing events through, i.e.
+// the window in which keys would be lost on a restart. Every run forks and
+// execs the daemon with DAEMON_ARGS plus '-' (stdin), writes a key frame
+// right away and waits for it to come out again.
+//
+// usage: bench_startup RUNS DAEMON_BINARY [DAEMON_ARGS...]
+
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Fork until the pass-through key is read back
+static uint64_t startup(char **args) {
+    const struct input_event frame[] = {
+        {.type = EV_KEY, .code = KEY_A, .value = 1},
+        {.type = EV_SYN, .code = SYN_REPORT, .value = 0},
+        {.type = EV_KEY, .code = KEY_A, .value = 0},
+        {.type = EV_SYN, .code = SYN_REPORT, .value = 0},
+    };
+    int in, out;
+    const uint64_t start = now_ns();
+    const pid_t pid      = spawn_daemon(args, &in, &out, NULL);
+    if (write(in, frame, sizeof(frame)) == -1)
+        err_exit("Failed on write");
+
+    struct input_event event;
+    size_t got = 0;
+    ssize_t n;
+    uint64_t elapsed = 0;
+    while (!elapsed &&
+           (n = read(out, (char *)&event + got, sizeof(event) - got)) > 0) {
+        got += n;
+        if (got < sizeof(event))
+            continue;
+        got = 0;
+        if (event.type == EV_KEY && event.code == KEY_A)
+            elapsed = now_ns() - start;
+    }
+    if (!elapsed) {
+        fprintf(stderr, "%s passed nothing through\n", args[0]);
+        exit(EXIT_FAILURE);
+    }
+    reap_daemon(pid, in, out);
+    return elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3 || argc > MAX_ARGS) {
+        fprintf(stderr, "usage: %s RUNS DAEMON_BINARY [DAEMON_ARGS...]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    const size_t runs = strtoul(argv[1], NULL, 10);
+    char *args[MAX_ARGS + 2];
+    char label[256] = "";
+    int a;
+    for (a = 3; a < argc; a++)
+        snprintf(label + strlen(label), sizeof(label) - strlen(label), "%s ",
+                 argv[a]);
+    daemon_args(args, argv + 2, argc - 2);
+
+    uint64_t *times = malloc(runs * sizeof(uint64_t));
+    if (!runs || !times)
+        return EXIT_FAILURE;
+    size_t i;
+    for (i = 0; i < runs; i++)
+        times[i] = startup(args);
+    qsort(times, runs, sizeof(uint64_t), cmp_u64);
+    printf("startup %-24s %zu runs  p50 %7.2fms  p99 %7.2fms  max %7.2fms\n",
+           label[0] ? label : "(defaults)", runs, times[runs / 2] / 1e6,
+           times[runs * 99 / 100] / 1e6, times[runs - 1] / 1e6);
+    free(times);
+}
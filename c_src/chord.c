@@ -0,0 +1,72 @@
+#include "chord.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "chord_impl.h"
+#include "chord_rules.h"
+
+// Runtime (table driven) chord engine, see `chord_static.h` for the variant
+// specialized at compile time.
+
+static const struct chord_rule RULES[] = {SIMUL_RULES};
+static const size_t NUM_RULES = sizeof(RULES) / sizeof(RULES[0]);
+
+////////////////////////////////////////////////////////////////////////////////
+// INIT
+////////////////////////////////////////////////////////////////////////////////
+int chord_config_set(struct chord_config *cfg, const struct chord_rule *rules,
+                     size_t num_rules, uint64_t threshold_ns) {
+    if (num_rules > CHORD_MAX_RULES) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->threshold_ns = threshold_ns;
+    cfg->num_rules    = num_rules;
+    memcpy(cfg->rules, rules, num_rules * sizeof(rules[0]));
+    memset(cfg->rule_of, CHORD_NOT_A_SOURCE, sizeof(cfg->rule_of));
+    size_t r, s;
+    for (r = 0; r < num_rules; r++) {
+        if (!rules[r].num_sources || rules[r].num_sources > CHORD_MAX_SOURCES ||
+            rules[r].target >= KEY_CNT) {
+            errno = EINVAL;
+            return -1;
+        }
+        for (s = 0; s < rules[r].num_sources; s++) {
+            const uint16_t code = rules[r].sources[s];
+            // A key can only be a source key of one rule
+            if (code >= KEY_CNT || cfg->rule_of[code] != CHORD_NOT_A_SOURCE) {
+                errno = EINVAL;
+                return -1;
+            }
+            cfg->rule_of[code] = r;
+            cfg->bit_of[code]  = s;
+        }
+    }
+    return 0;
+}
+
+void chord_config_init(struct chord_config *cfg) {
+    chord_config_set(cfg, RULES, NUM_RULES, SIMUL_THRESHOLD);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// API
+////////////////////////////////////////////////////////////////////////////////
+size_t chord_feed(const struct chord_config *cfg, struct chord_state *st,
+                  const struct input_event *event, uint64_t now,
+                  struct input_event *out) {
+    return chord_impl_feed(cfg, st, event, now, out);
+}
+
+size_t chord_expire(const struct chord_config *cfg, struct chord_state *st,
+                    uint64_t now, struct input_event *out) {
+    (void)cfg;  // Not needed, kept so every call takes the same arguments
+    return chord_impl_expire(st, now, out);
+}
+
+size_t chord_reset(const struct chord_config *cfg, struct chord_state *st,
+                   struct input_event *out) {
+    return chord_impl_reset(cfg, st, out);
+}
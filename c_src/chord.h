@@ -0,0 +1,129 @@
+#ifndef SIMUL_CHORD_H
+#define SIMUL_CHORD_H
+
+#include <linux/input.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// LIMITS
+////////////////////////////////////////////////////////////////////////////////
+#define CHORD_MAX_RULES 8
+#define CHORD_MAX_SOURCES 4
+#define CHORD_MAX_PENDING (CHORD_MAX_RULES * CHORD_MAX_SOURCES)
+// Worst case output of a single `chord_feed` call: every pending source key
+// gets flushed (key event + SYN each), plus the incoming/target event itself
+#define CHORD_MAX_OUT (2 * CHORD_MAX_PENDING + 2)
+#define CHORD_NO_DEADLINE UINT64_MAX
+#define CHORD_NOT_A_SOURCE 0xff
+
+////////////////////////////////////////////////////////////////////////////////
+// CONFIG
+////////////////////////////////////////////////////////////////////////////////
+// Pressing all `sources` within `threshold_ns` of each other produces
+// `target`. A key may be a source key of at most one rule.
+struct chord_rule {
+    uint16_t sources[CHORD_MAX_SOURCES];
+    uint8_t num_sources;
+    uint16_t target;
+};
+
+// Shared (read-only) between all engines using the same rule set.
+// `rule_of`/`bit_of` are lookup tables indexed by key code, built by
+// `chord_config_init` so the hot path never has to search `rules`.
+struct chord_config {
+    uint64_t threshold_ns;
+    uint8_t num_rules;
+    struct chord_rule rules[CHORD_MAX_RULES];
+    uint8_t rule_of[KEY_CNT];
+    uint8_t bit_of[KEY_CNT];
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// STATE
+////////////////////////////////////////////////////////////////////////////////
+// A swallowed source key press, waiting for its chord or its deadline
+struct chord_pending {
+    uint64_t deadline;
+    struct timeval time;
+    uint16_t code;
+    uint8_t rule;
+    uint8_t bit;  // Position of `code` within the rule's sources
+};
+
+// Per-rule target tracking, replaces the old global `TARGETS_STATE`:
+// `held` has a bit set for every source key of the fired chord that has not
+// been released yet, `target_down` is set while the target press is written
+// but its release is not.
+struct chord_rule_state {
+    uint8_t held;
+    bool target_down;
+};
+
+// Everything one input stream needs, small enough to keep one per device.
+// `pending` is kept in press order so flushing never reorders source keys.
+struct chord_state {
+    uint8_t num_pending;
+    struct chord_pending pending[CHORD_MAX_PENDING];
+    struct chord_rule_state rules[CHORD_MAX_RULES];
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// API
+////////////////////////////////////////////////////////////////////////////////
+// All functions below are pure: no I/O, no allocation, no clock reads.
+// `now` is a nanosecond timestamp on whatever clock the caller uses, and
+// output events are written to `out`, which must hold `CHORD_MAX_OUT` events.
+// The return value is the number of events written to `out`.
+// Rule set of `chord_rules.h`
+void chord_config_init(struct chord_config *cfg);
+
+// Any other rule set, -1 (errno EINVAL) if it doesn't fit the limits above or
+// a key is a source key of more than one rule
+int chord_config_set(struct chord_config *cfg, const struct chord_rule *rules,
+                     size_t num_rules, uint64_t threshold_ns);
+
+static inline void chord_state_init(struct chord_state *st) {
+    memset(st, 0, sizeof(*st));
+}
+
+size_t chord_feed(const struct chord_config *cfg, struct chord_state *st,
+                  const struct input_event *event, uint64_t now,
+                  struct input_event *out);
+
+// Flushes every pending source key whose threshold ran out at `now`
+size_t chord_expire(const struct chord_config *cfg, struct chord_state *st,
+                    uint64_t now, struct input_event *out);
+
+// Drops pending presses and releases any target that is still down, used
+// when the input stream goes away (e.g. the device got unplugged)
+size_t chord_reset(const struct chord_config *cfg, struct chord_state *st,
+                   struct input_event *out);
+
+static inline uint64_t chord_next_deadline(const struct chord_state *st) {
+    return st->num_pending ? st->pending[0].deadline : CHORD_NO_DEADLINE;
+}
+
+// Forgets the swallowed press of `code` without writing it (e.g. its device
+// got unplugged while the state lives on), false if it isn't pending
+static inline bool chord_drop_pending(struct chord_state *st, uint16_t code) {
+    int i;
+    for (i = 0; i < st->num_pending; i++) {
+        if (st->pending[i].code == code) {
+            st->num_pending--;
+            memmove(&st->pending[i], &st->pending[i + 1],
+                    (st->num_pending - i) * sizeof(st->pending[0]));
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline bool chord_is_source_key(const struct chord_config *cfg,
+                                       uint16_t code) {
+    return code < KEY_CNT && cfg->rule_of[code] != CHORD_NOT_A_SOURCE;
+}
+
+#endif
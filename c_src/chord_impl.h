@@ -0,0 +1,270 @@
+#ifndef SIMUL_CHORD_IMPL_H
+#define SIMUL_CHORD_IMPL_H
+
+#include <string.h>
+
+#include "chord.h"
+
+// The chord engine itself, as `static inline` functions taking the config
+// as a pointer. Only meant to be included by `chord.c` (runtime config),
+// `simulkeys.c` (runtime config as well, inlined into its batch loop) and
+// `chord_static.h` (config known at compile time, where the compiler folds
+// rule counts, key codes and masks into the code).
+//
+// Source key lookup differs between the two: define CHORD_IMPL_CONST_RULES
+// before including to scan the (constant) rules instead of using the
+// `rule_of`/`bit_of` tables, which a constant config leaves empty.
+
+////////////////////////////////////////////////////////////////////////////////
+// APPLICATION CONSTANTS
+////////////////////////////////////////////////////////////////////////////////
+#define KEY_RELEASED 0
+#define KEY_PRESSED 1
+#define KEY_REPEATED 2
+
+////////////////////////////////////////////////////////////////////////////////
+// LOOKUP
+////////////////////////////////////////////////////////////////////////////////
+// Rule index of `code` (CHORD_NOT_A_SOURCE if none), `bit` is set to its
+// position within the rule's sources
+static inline uint8_t chord_impl_lookup(const struct chord_config *cfg,
+                                        uint16_t code, uint8_t *bit) {
+#ifdef CHORD_IMPL_CONST_RULES
+    // Unrolled into a compare chain against immediates
+    uint8_t r, s;
+    for (r = 0; r < cfg->num_rules; r++) {
+        for (s = 0; s < cfg->rules[r].num_sources; s++) {
+            if (cfg->rules[r].sources[s] == code) {
+                *bit = s;
+                return r;
+            }
+        }
+    }
+    return CHORD_NOT_A_SOURCE;
+#else
+    if (code >= KEY_CNT)
+        return CHORD_NOT_A_SOURCE;
+    *bit = cfg->bit_of[code];
+    return cfg->rule_of[code];
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// OUTPUT UTILS
+////////////////////////////////////////////////////////////////////////////////
+static inline size_t chord_impl_emit_key(struct input_event *out, size_t n,
+                                         const struct timeval *time,
+                                         uint16_t code, int32_t value) {
+    out[n].time  = *time;
+    out[n].type  = EV_KEY;
+    out[n].code  = code;
+    out[n].value = value;
+    return n + 1;
+}
+
+static inline size_t chord_impl_emit_syn(struct input_event *out, size_t n,
+                                         const struct timeval *time) {
+    out[n].time  = *time;
+    out[n].type  = EV_SYN;
+    out[n].code  = SYN_REPORT;
+    out[n].value = 0;
+    return n + 1;
+}
+
+// Writes the swallowed press of `p` as a frame of its own
+static inline size_t chord_impl_emit_pending(struct input_event *out, size_t n,
+                                             const struct chord_pending *p) {
+    n = chord_impl_emit_key(out, n, &p->time, p->code, KEY_PRESSED);
+    return chord_impl_emit_syn(out, n, &p->time);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// PENDING UTILS
+////////////////////////////////////////////////////////////////////////////////
+static inline int chord_impl_find_pending(const struct chord_state *st,
+                                          uint16_t code) {
+    int i;
+    for (i = 0; i < st->num_pending; i++)
+        if (st->pending[i].code == code)
+            return i;
+    return -1;
+}
+
+static inline uint8_t chord_impl_pending_mask(const struct chord_state *st,
+                                              uint8_t rule) {
+    uint8_t mask = 0;
+    int i;
+    for (i = 0; i < st->num_pending; i++)
+        if (st->pending[i].rule == rule)
+            mask |= 1 << st->pending[i].bit;
+    return mask;
+}
+
+static inline size_t chord_impl_flush_all(struct chord_state *st,
+                                          struct input_event *out, size_t n) {
+    int i;
+    for (i = 0; i < st->num_pending; i++)
+        n = chord_impl_emit_pending(out, n, &st->pending[i]);
+    st->num_pending = 0;
+    return n;
+}
+
+// Chord fired: keys of `rule` are consumed, any other pending key was pressed
+// before the chord completed so it gets flushed first to keep the order
+static inline size_t chord_impl_consume(struct chord_state *st, uint8_t rule,
+                                        struct input_event *out, size_t n) {
+    int i;
+    for (i = 0; i < st->num_pending; i++)
+        if (st->pending[i].rule != rule)
+            n = chord_impl_emit_pending(out, n, &st->pending[i]);
+    st->num_pending = 0;
+    return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// EVENT HANDLERS
+////////////////////////////////////////////////////////////////////////////////
+static inline size_t chord_impl_press(const struct chord_config *cfg,
+                                      struct chord_state *st,
+                                      const struct input_event *event,
+                                      uint8_t rule, uint8_t bit, uint64_t now,
+                                      struct input_event *out, size_t n) {
+    const struct chord_rule *r  = &cfg->rules[rule];
+    struct chord_rule_state *rs = &st->rules[rule];
+    const uint8_t all           = (1 << r->num_sources) - 1;
+
+    // Already swallowed (no release in between), nothing new to do
+    if (chord_impl_find_pending(st, event->code) >= 0)
+        return n;
+
+    if (!rs->held && (chord_impl_pending_mask(st, rule) | 1 << bit) == all) {
+        n               = chord_impl_consume(st, rule, out, n);
+        rs->held        = all;
+        rs->target_down = true;
+        return chord_impl_emit_key(out, n, &event->time, r->target,
+                                   KEY_PRESSED);
+    }
+
+    // Swallow, written on deadline or when something else comes in
+    struct chord_pending *p = &st->pending[st->num_pending++];
+    p->deadline             = now + cfg->threshold_ns;
+    p->time                 = event->time;
+    p->code                 = event->code;
+    p->rule                 = rule;
+    p->bit                  = bit;
+    return n;
+}
+
+static inline size_t chord_impl_release(const struct chord_config *cfg,
+                                        struct chord_state *st,
+                                        const struct input_event *event,
+                                        uint8_t rule, uint8_t bit,
+                                        struct input_event *out, size_t n) {
+    struct chord_rule_state *rs = &st->rules[rule];
+
+    if (rs->held & 1 << bit) {
+        // First released source key of a chord releases the target, the
+        // releases of the other source keys are swallowed
+        rs->held &= ~(1 << bit);
+        if (rs->target_down) {
+            rs->target_down = false;
+            n = chord_impl_emit_key(out, n, &event->time,
+                                    cfg->rules[rule].target, KEY_RELEASED);
+        }
+        return n;
+    }
+    // Source key released before threshold has been reached
+    if (chord_impl_find_pending(st, event->code) >= 0)
+        n = chord_impl_flush_all(st, out, n);
+    out[n] = *event;
+    return n + 1;
+}
+
+static inline size_t chord_impl_repeat(const struct chord_config *cfg,
+                                       struct chord_state *st,
+                                       const struct input_event *event,
+                                       uint8_t rule, uint8_t bit,
+                                       struct input_event *out, size_t n) {
+    struct chord_rule_state *rs = &st->rules[rule];
+
+    if (rs->held & 1 << bit) {
+        if (rs->target_down)
+            n = chord_impl_emit_key(out, n, &event->time,
+                                    cfg->rules[rule].target, KEY_REPEATED);
+        return n;
+    }
+    if (chord_impl_find_pending(st, event->code) >= 0)
+        n = chord_impl_flush_all(st, out, n);
+    out[n] = *event;
+    return n + 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// API
+////////////////////////////////////////////////////////////////////////////////
+static inline size_t chord_impl_expire(struct chord_state *st, uint64_t now,
+                                       struct input_event *out) {
+    size_t n = 0;
+    int expired;
+    for (expired = 0; expired < st->num_pending; expired++) {
+        if (st->pending[expired].deadline > now)
+            break;
+        n = chord_impl_emit_pending(out, n, &st->pending[expired]);
+    }
+    if (expired) {
+        st->num_pending -= expired;
+        memmove(st->pending, st->pending + expired,
+                st->num_pending * sizeof(st->pending[0]));
+    }
+    return n;
+}
+
+static inline size_t chord_impl_feed(const struct chord_config *cfg,
+                                     struct chord_state *st,
+                                     const struct input_event *event,
+                                     uint64_t now, struct input_event *out) {
+    size_t n = 0;
+    if (st->num_pending && st->pending[0].deadline <= now)
+        n = chord_impl_expire(st, now, out);
+
+    uint8_t bit  = 0;
+    uint8_t rule = event->type == EV_KEY
+                       ? chord_impl_lookup(cfg, event->code, &bit)
+                       : CHORD_NOT_A_SOURCE;
+    if (rule == CHORD_NOT_A_SOURCE) {
+        // Another key going down means the swallowed keys weren't meant
+        // as a chord, write them before it
+        if (event->type == EV_KEY && event->value == KEY_PRESSED)
+            n = chord_impl_flush_all(st, out, n);
+        out[n] = *event;
+        return n + 1;
+    }
+
+    switch (event->value) {
+        case KEY_PRESSED:
+            return chord_impl_press(cfg, st, event, rule, bit, now, out, n);
+        case KEY_RELEASED:
+            return chord_impl_release(cfg, st, event, rule, bit, out, n);
+        default:
+            return chord_impl_repeat(cfg, st, event, rule, bit, out, n);
+    }
+}
+
+static inline size_t chord_impl_reset(const struct chord_config *cfg,
+                                      struct chord_state *st,
+                                      struct input_event *out) {
+    const struct timeval zero = {0};
+    size_t n                  = 0;
+    size_t r;
+    for (r = 0; r < cfg->num_rules; r++) {
+        if (st->rules[r].target_down) {
+            n = chord_impl_emit_key(out, n, &zero, cfg->rules[r].target,
+                                    KEY_RELEASED);
+            n = chord_impl_emit_syn(out, n, &zero);
+        }
+    }
+    memset(st, 0, sizeof(*st));
+    return n;
+}
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef SIMUL_CHORD_RULES_H
+#define SIMUL_CHORD_RULES_H
+
+#include <linux/input.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// CONFIG
+////////////////////////////////////////////////////////////////////////////////
+// Define your chords, each rule needs 2 to CHORD_MAX_SOURCES source keys.
+// Used by both the runtime engine (`chord.c`) and the compile time
+// specialized one (`chord_static.h`).
+#define SIMUL_RULES \
+    {.sources = {KEY_J, KEY_K}, .num_sources = 2, .target = KEY_ESC},
+// Define threshold time
+#define SIMUL_THRESHOLD 50e6  // 50ms - Same as KarabinerElements' default
+
+#endif
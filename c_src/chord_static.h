@@ -0,0 +1,49 @@
+#ifndef SIMUL_CHORD_STATIC_H
+#define SIMUL_CHORD_STATIC_H
+
+#define CHORD_IMPL_CONST_RULES
+#include "chord_impl.h"
+
+// Chord engine specialized for a rule set known at compile time: the config
+// is a `static const` object, so after inlining the rule count, source key
+// codes, bit masks and threshold are all immediates and there is no lookup
+// table to load from. Same behaviour as `chord.c`, same `struct chord_state`.
+//
+// CHORD_STATIC_ENGINE(name, threshold_ns, rules...) defines `name_config`
+// and `name_feed`, `name_expire`, `name_reset`, e.g.
+//     CHORD_STATIC_ENGINE(simul, SIMUL_THRESHOLD, SIMUL_RULES)
+// Only the lookup paths need a constant config, `name_config` still works
+// with `chord_next_deadline`, but not with `chord_is_source_key` (tables are
+// left empty), use `name_is_source_key` instead.
+
+#define CHORD_STATIC_ENGINE(name, threshold, ...)                              \
+    static const struct chord_config name##_config = {                        \
+        .threshold_ns = (threshold),                                           \
+        .num_rules    = sizeof((struct chord_rule[]){__VA_ARGS__}) /           \
+                     sizeof(struct chord_rule),                                \
+        .rules = {__VA_ARGS__},                                                \
+    };                                                                         \
+                                                                               \
+    static inline size_t name##_feed(struct chord_state *st,                   \
+                                     const struct input_event *event,          \
+                                     uint64_t now, struct input_event *out) {  \
+        return chord_impl_feed(&name##_config, st, event, now, out);           \
+    }                                                                          \
+                                                                               \
+    static inline size_t name##_expire(struct chord_state *st, uint64_t now,   \
+                                       struct input_event *out) {              \
+        return chord_impl_expire(st, now, out);                                \
+    }                                                                          \
+                                                                               \
+    static inline size_t name##_reset(struct chord_state *st,                  \
+                                      struct input_event *out) {               \
+        return chord_impl_reset(&name##_config, st, out);                      \
+    }                                                                          \
+                                                                               \
+    static inline bool name##_is_source_key(uint16_t code) {                   \
+        uint8_t bit;                                                           \
+        return chord_impl_lookup(&name##_config, code, &bit) !=                \
+               CHORD_NOT_A_SOURCE;                                             \
+    }
+
+#endif
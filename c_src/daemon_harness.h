@@ -0,0 +1,79 @@
+#ifndef SIMUL_DAEMON_HARNESS_H
+#define SIMUL_DAEMON_HARNESS_H
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Shared by the tests and benchmarks that run `simul_daemon` (or any other
+// filter reading stdin) as a child process, talking to it through pipes:
+//
+//   char *args[MAX_ARGS + 2];
+//   daemon_args(args, argv + 2, argc - 2);  // DAEMON_BINARY [ARGS...] -
+//   int in, out, err;
+//   pid_t pid = spawn_daemon(args, &in, &out, &err);
+//   ... write to `in`, read `out` and `err` ...
+//   reap_daemon(pid, in, out);
+
+#define err_exit(msg)       \
+    {                       \
+        perror(msg);        \
+        exit(EXIT_FAILURE); \
+    }
+#define MS 1000000
+#define MAX_ARGS 32
+
+// `argv` (`argc` of them, the binary first) with "-" (stdin) appended and
+// NULL terminated, `args` has to hold `argc + 2`
+static inline void daemon_args(char **args, char *const *argv, int argc) {
+    int a;
+    for (a = 0; a < argc; a++)
+        args[a] = argv[a];
+    args[argc]     = "-";
+    args[argc + 1] = NULL;
+}
+
+// Starts `args[0]` with its stdin, stdout and stderr on pipes, our ends are
+// returned in `in`, `out` and `err` (stderr is left alone if `err` is NULL)
+static inline pid_t spawn_daemon(char *const *args, int *in, int *out,
+                                 int *err) {
+    int in_pipe[2], out_pipe[2], err_pipe[2];
+    if (pipe2(in_pipe, O_CLOEXEC) == -1 || pipe2(out_pipe, O_CLOEXEC) == -1 ||
+        (err && pipe2(err_pipe, O_CLOEXEC) == -1))
+        err_exit("Failed on pipe2");
+    const pid_t pid = fork();
+    if (pid == -1)
+        err_exit("Failed on fork");
+    if (!pid) {
+        dup2(in_pipe[0], STDIN_FILENO);
+        dup2(out_pipe[1], STDOUT_FILENO);
+        if (err)
+            dup2(err_pipe[1], STDERR_FILENO);
+        execv(args[0], args);
+        err_exit("Failed on execv");
+    }
+    close(in_pipe[0]), close(out_pipe[1]);
+    *in  = in_pipe[1];
+    *out = out_pipe[0];
+    if (err) {
+        close(err_pipe[1]);
+        *err = err_pipe[0];
+    }
+    return pid;
+}
+
+// Closes its stdin (unless `in` is -1, closed already), reads whatever it
+// still writes until it exits and waits for it
+static inline void reap_daemon(pid_t pid, int in, int out) {
+    char buf[4096];
+    if (in != -1)
+        close(in);
+    while (read(out, buf, sizeof(buf)) > 0)
+        ;
+    close(out);
+    waitpid(pid, NULL, 0);
+}
+
+#endif
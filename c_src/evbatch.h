@@ -0,0 +1,111 @@
+#ifndef SIMUL_EVBATCH_H
+#define SIMUL_EVBATCH_H
+
+#include <linux/input.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define EVBATCH_AVX2
+#include <immintrin.h>
+#endif
+
+// Helpers for working on whole buffers of `input_event`s as read from a
+// device or pipe, instead of one event at a time.
+
+// Number of leading events that are not EV_KEY. Those never need to go
+// through the chord logic (pointer motion, MSC_SCAN, SYN_REPORT, ...) and can
+// be forwarded straight from the read buffer in one write.
+static inline size_t evbatch_skip_non_key(const struct input_event *events,
+                                          size_t count) {
+    size_t i = 0;
+    while (i < count && events[i].type != EV_KEY)
+        i++;
+    return i;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// SOURCE KEY SCAN
+////////////////////////////////////////////////////////////////////////////////
+// Bitmap of key codes, e.g. all source keys of a rule set
+struct evbatch_keyset {
+    uint32_t bits[(KEY_CNT + 31) / 32];
+};
+
+static inline void evbatch_keyset_clear(struct evbatch_keyset *set) {
+    memset(set, 0, sizeof(*set));
+}
+
+static inline void evbatch_keyset_add(struct evbatch_keyset *set,
+                                      uint16_t code) {
+    if (code < KEY_CNT)
+        set->bits[code / 32] |= 1u << code % 32;
+}
+
+static inline bool evbatch_keyset_has(const struct evbatch_keyset *set,
+                                      uint16_t code) {
+    return code < KEY_CNT && set->bits[code / 32] >> code % 32 & 1;
+}
+
+static inline size_t evbatch_skip_non_source_scalar(
+    const struct input_event *events, size_t count,
+    const struct evbatch_keyset *set) {
+    size_t i = 0;
+    while (i < count &&
+           !(events[i].type == EV_KEY && evbatch_keyset_has(set, events[i].code)))
+        i++;
+    return i;
+}
+
+#ifdef EVBATCH_AVX2
+// 8 events (192 bytes) per step in six plain loads, every 16 bit word is
+// compared against EV_KEY and only the words holding a `type` are kept. The
+// rare EV_KEY events found that way get the bitmap check.
+__attribute__((target("avx2"))) static inline size_t
+evbatch_skip_non_source_avx2(const struct input_event *events, size_t count,
+                             const struct evbatch_keyset *set) {
+    _Static_assert(sizeof(struct input_event) == 24 &&
+                       offsetof(struct input_event, type) == 16,
+                   "type positions below assume the x86_64 layout");
+    // `type` is at byte 16, 40, 64 and 88 of every 96 bytes, these are the
+    // `movemask` bits of those bytes in three consecutive 32 byte loads
+    const uint32_t at0 = 1u << 16, at1 = 1u << 8, at2 = 1u << 0 | 1u << 24;
+    const __m256i ev_key = _mm256_set1_epi16(EV_KEY);
+    size_t i             = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i *p = (const __m256i *)(events + i);
+#define EVBATCH_TYPE_IS_KEY(v, at) \
+    (_mm256_movemask_epi8(         \
+         _mm256_cmpeq_epi16(_mm256_loadu_si256(p + (v)), ev_key)) & (at))
+        const uint32_t found =
+            EVBATCH_TYPE_IS_KEY(0, at0) | EVBATCH_TYPE_IS_KEY(1, at1) |
+            EVBATCH_TYPE_IS_KEY(2, at2) | EVBATCH_TYPE_IS_KEY(3, at0) |
+            EVBATCH_TYPE_IS_KEY(4, at1) | EVBATCH_TYPE_IS_KEY(5, at2);
+#undef EVBATCH_TYPE_IS_KEY
+        if (!found)
+            continue;
+        const size_t skip = evbatch_skip_non_source_scalar(events + i, 8, set);
+        if (skip < 8)
+            return i + skip;
+    }
+    return i + evbatch_skip_non_source_scalar(events + i, count - i, set);
+}
+#endif
+
+// Number of leading events that are not a source key (an EV_KEY event with a
+// code in `set`). While no source key press is held back, those all go
+// through the chord logic unchanged and can be forwarded in one write as
+// well. Uses AVX2 when the CPU has it.
+static inline size_t evbatch_skip_non_source(const struct input_event *events,
+                                             size_t count,
+                                             const struct evbatch_keyset *set) {
+#ifdef EVBATCH_AVX2
+    if (count >= 8 && __builtin_cpu_supports("avx2"))
+        return evbatch_skip_non_source_avx2(events, count, set);
+#endif
+    return evbatch_skip_non_source_scalar(events, count, set);
+}
+
+#endif
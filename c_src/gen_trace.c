@@ -0,0 +1,111 @@
+#include <linux/input.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Writes a synthetic binary `input_event` trace to stdout, for trying out
+// `simul_trace` without hours of recordings: typing (with plenty of J and K,
+// so some of it rolls), deliberate J+K chords pressed 0-40ms apart, and
+// pointer motion between typing bursts. Same SEED, same trace.
+//
+// usage: gen_trace SECONDS [SEED] > trace.bin
+
+#define err_exit(msg)       \
+    {                       \
+        perror(msg);        \
+        exit(EXIT_FAILURE); \
+    }
+#define BUF_EVENTS 4096
+#define MS 1000000ULL
+
+static struct input_event BUF[BUF_EVENTS];
+static size_t NUM_BUF;
+static uint64_t SEED;
+
+static uint64_t rnd(uint64_t range) {
+    SEED = SEED * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (SEED >> 33) % range;
+}
+
+static void flush(void) {
+    if (NUM_BUF && write(STDOUT_FILENO, BUF, NUM_BUF * sizeof(BUF[0])) == -1)
+        err_exit("Failed on write");
+    NUM_BUF = 0;
+}
+
+static void emit(uint64_t t, uint16_t type, uint16_t code, int32_t value) {
+    if (NUM_BUF == BUF_EVENTS)
+        flush();
+    BUF[NUM_BUF++] = (struct input_event){
+        .time  = {.tv_sec = t / 1000000000, .tv_usec = t % 1000000000 / 1000},
+        .type  = type,
+        .code  = code,
+        .value = value};
+}
+
+static void key_frame(uint64_t t, uint16_t code, int32_t value) {
+    emit(t, EV_MSC, MSC_SCAN, code);
+    emit(t, EV_KEY, code, value);
+    emit(t, EV_SYN, SYN_REPORT, 0);
+}
+
+// A word: keys 60-200ms apart, each held 50-120ms, so neighbours overlap
+static uint64_t type_word(uint64_t t) {
+    static const uint16_t keys[] = {KEY_J, KEY_K, KEY_A, KEY_S, KEY_D,
+                                    KEY_F, KEY_L, KEY_E, KEY_I, KEY_O};
+    uint64_t release_at = 0;
+    uint16_t held       = KEY_RESERVED;
+    size_t n            = 2 + rnd(6), i;
+    for (i = 0; i < n; i++) {
+        const uint16_t code = keys[rnd(sizeof(keys) / sizeof(keys[0]))];
+        if (held != KEY_RESERVED && (release_at <= t || held == code)) {
+            key_frame(release_at <= t ? release_at : t, held, 0);
+            held = KEY_RESERVED;
+        }
+        key_frame(t, code, 1);
+        if (held != KEY_RESERVED)
+            key_frame(t + rnd(30 * MS), held, 0);
+        held       = code;
+        release_at = t + 50 * MS + rnd(70 * MS);
+        t += 60 * MS + rnd(140 * MS);
+    }
+    key_frame(release_at, held, 0);
+    return (release_at > t ? release_at : t) + 300 * MS;
+}
+
+static uint64_t chord(uint64_t t) {
+    const uint64_t gap = rnd(40 * MS);
+    const uint16_t first = rnd(2) ? KEY_J : KEY_K;
+    key_frame(t, first, 1);
+    key_frame(t + gap, first == KEY_J ? KEY_K : KEY_J, 1);
+    t += gap + 60 * MS + rnd(60 * MS);
+    key_frame(t, KEY_J, 0);
+    key_frame(t + rnd(20 * MS), KEY_K, 0);
+    return t + 500 * MS;
+}
+
+static uint64_t move_pointer(uint64_t t) {
+    size_t n = 20 + rnd(200), i;
+    for (i = 0; i < n; i++, t += 8 * MS) {
+        emit(t, EV_REL, REL_X, (int32_t)rnd(11) - 5);
+        emit(t, EV_REL, REL_Y, (int32_t)rnd(11) - 5);
+        emit(t, EV_SYN, SYN_REPORT, 0);
+    }
+    return t + 200 * MS;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s SECONDS [SEED] > trace.bin\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const uint64_t end = strtoull(argv[1], NULL, 10) * 1000000000;
+    SEED               = argc > 2 ? strtoull(argv[2], NULL, 10) : 1;
+    uint64_t t         = 1000000000;
+    while (t < end) {
+        const uint64_t what = rnd(10);
+        t = what < 6 ? type_word(t) : what < 7 ? chord(t) : move_pointer(t);
+    }
+    flush();
+}
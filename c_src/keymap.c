@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+#include "keymap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// UTILS
+////////////////////////////////////////////////////////////////////////////////
+static uint32_t checksum(const struct keymap_image *img) {
+    const unsigned char *p   = (const unsigned char *)(&img->header + 1);
+    const unsigned char *end = (const unsigned char *)(img + 1);
+    uint32_t hash            = 2166136261u;
+    for (; p < end; p++)
+        hash = (hash ^ *p) * 16777619u;
+    return hash;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// API
+////////////////////////////////////////////////////////////////////////////////
+void keymap_build(struct keymap_image *img, const struct chord_config *cfg) {
+    // Padding included, so the checksum covers defined bytes only
+    memset(img, 0, sizeof(*img));
+    memcpy(img->header.magic, KEYMAP_MAGIC, sizeof(KEYMAP_MAGIC));
+    img->header.version     = KEYMAP_VERSION;
+    img->header.image_size  = sizeof(struct keymap_image);
+    img->header.config_size = sizeof(struct chord_config);
+    img->header.key_cnt     = KEY_CNT;
+    img->config             = *cfg;
+    evbatch_keyset_clear(&img->sources);
+    size_t r, s;
+    for (r = 0; r < cfg->num_rules; r++)
+        for (s = 0; s < cfg->rules[r].num_sources; s++)
+            evbatch_keyset_add(&img->sources, cfg->rules[r].sources[s]);
+    img->header.checksum = checksum(img);
+}
+
+int keymap_save(const char *path, const struct chord_config *cfg) {
+    struct keymap_image *img = malloc(sizeof(*img));
+    char *tmp                = NULL;
+    int fd                   = -1, error;
+    if (!img || asprintf(&tmp, "%s.tmp", path) == -1) {
+        tmp = NULL;
+        goto fail;
+    }
+    keymap_build(img, cfg);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1 || write_all(fd, img, sizeof(*img)) == -1 || fsync(fd) == -1)
+        goto fail;
+    if (close(fd) == -1) {
+        fd = -1;
+        goto fail;
+    }
+    fd = -1;
+    if (rename(tmp, path) == -1)
+        goto fail;
+    free(tmp);
+    free(img);
+    return 0;
+fail:
+    error = errno;
+    if (fd != -1)
+        close(fd);
+    if (tmp)
+        unlink(tmp);
+    free(tmp);
+    free(img);
+    errno = error;
+    return -1;
+}
+
+const struct keymap_image *keymap_map(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return NULL;
+    }
+    if ((size_t)st.st_size != sizeof(struct keymap_image)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    // Prefaulted, the first key press shouldn't wait for a page fault
+    const struct keymap_image *img =
+        mmap(NULL, sizeof(*img), PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (img == MAP_FAILED)
+        return NULL;
+    const struct keymap_header *h = &img->header;
+    if (memcmp(h->magic, KEYMAP_MAGIC, sizeof(KEYMAP_MAGIC)) ||
+        h->version != KEYMAP_VERSION ||
+        h->image_size != sizeof(struct keymap_image) ||
+        h->config_size != sizeof(struct chord_config) ||
+        h->key_cnt != KEY_CNT || h->checksum != checksum(img) ||
+        img->config.num_rules > CHORD_MAX_RULES) {
+        keymap_unmap(img);
+        errno = EINVAL;
+        return NULL;
+    }
+    return img;
+}
+
+void keymap_unmap(const struct keymap_image *img) {
+    munmap((void *)img, sizeof(*img));
+}
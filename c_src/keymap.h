@@ -0,0 +1,49 @@
+#ifndef SIMUL_KEYMAP_H
+#define SIMUL_KEYMAP_H
+
+#include <stdint.h>
+
+#include "chord.h"
+#include "evbatch.h"
+
+// Precompiled keymap images: the chord engine's lookup tables and source key
+// set, built once by `simul_keymap` and written out as is. Everything in
+// them is plain arrays (no pointers), so loading one is an `mmap` and a
+// header check, the tables are used right from the mapping:
+//
+//     const struct keymap_image *img = keymap_map("keymap.bin");
+//     chord_feed(&img->config, &st, &event, now, out);
+//
+// Images are only valid for the build they were made with (struct layout and
+// KEY_CNT are checked), rebuild them along with the binaries.
+
+#define KEYMAP_MAGIC "SIMULKM"
+#define KEYMAP_VERSION 1
+
+struct keymap_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t image_size;   // sizeof(struct keymap_image)
+    uint32_t config_size;  // sizeof(struct chord_config)
+    uint32_t key_cnt;      // KEY_CNT the tables are indexed by
+    uint32_t checksum;     // FNV-1a of everything after the header
+    uint32_t reserved;
+};
+
+struct keymap_image {
+    struct keymap_header header;
+    struct chord_config config;
+    struct evbatch_keyset sources;
+};
+
+// Fills `img` (header, tables and source key set) from `cfg`
+void keymap_build(struct keymap_image *img, const struct chord_config *cfg);
+// Writes the image next to `path` and renames it into place, so a daemon
+// starting meanwhile never maps half an image. -1 (errno set) on failure.
+int keymap_save(const char *path, const struct chord_config *cfg);
+// Read-only, prefaulted mapping of the image at `path`. NULL (errno set) if
+// it can't be mapped, EINVAL if it isn't an image of this build.
+const struct keymap_image *keymap_map(const char *path);
+void keymap_unmap(const struct keymap_image *img);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef SIMUL_LATHIST_H
+#define SIMUL_LATHIST_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Log-linear latency histogram: LATHIST_SUB buckets per power of two of
+// microseconds (12.5% wide), exact below LATHIST_SUB us, so anything from a
+// microsecond to hours fits in a few KB. Adding is O(1) (a bit scan, no
+// search), quantiles walk the buckets:
+//
+//   struct lathist h;
+//   lathist_clear(&h);
+//   lathist_add(&h, ns);
+//   uint64_t p99 = lathist_quantile(&h, 990);
+
+#define LATHIST_SUB_BITS 3
+#define LATHIST_SUB (1 << LATHIST_SUB_BITS)
+#define LATHIST_BUCKETS ((64 - LATHIST_SUB_BITS + 1) * LATHIST_SUB)
+
+struct lathist {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[LATHIST_BUCKETS];
+};
+
+static inline void lathist_clear(struct lathist *h) {
+    memset(h, 0, sizeof(*h));
+}
+
+static inline unsigned lathist_bucket(uint64_t ns) {
+    const uint64_t us = ns / 1000;
+    if (us < LATHIST_SUB)
+        return us;
+    const unsigned shift = 63 - __builtin_clzll(us) - LATHIST_SUB_BITS;
+    return ((shift + 1) << LATHIST_SUB_BITS) +
+           ((us >> shift) & (LATHIST_SUB - 1));
+}
+
+// Upper edge of bucket `b`, in ns
+static inline uint64_t lathist_edge(unsigned b) {
+    if (b < LATHIST_SUB)
+        return (uint64_t)(b + 1) * 1000;
+    const unsigned shift = (b >> LATHIST_SUB_BITS) - 1;
+    return (((uint64_t)(LATHIST_SUB + (b & (LATHIST_SUB - 1))) << shift) +
+            ((uint64_t)1 << shift)) *
+           1000;
+}
+
+static inline void lathist_add(struct lathist *h, uint64_t ns) {
+    h->count++;
+    h->sum_ns += ns;
+    if (ns > h->max_ns)
+        h->max_ns = ns;
+    h->buckets[lathist_bucket(ns)]++;
+}
+
+static inline void lathist_merge(struct lathist *dst,
+                                 const struct lathist *src) {
+    unsigned b;
+    dst->count += src->count;
+    dst->sum_ns += src->sum_ns;
+    if (src->max_ns > dst->max_ns)
+        dst->max_ns = src->max_ns;
+    for (b = 0; b < LATHIST_BUCKETS; b++)
+        dst->buckets[b] += src->buckets[b];
+}
+
+// Upper edge of the bucket holding the `per_mille`th value (capped at the
+// maximum), 0 if empty
+static inline uint64_t lathist_quantile(const struct lathist *h,
+                                        unsigned per_mille) {
+    if (!h->count)
+        return 0;
+    const uint64_t rank = (h->count * per_mille + 999) / 1000;
+    uint64_t seen       = 0;
+    unsigned b;
+    for (b = 0; b < LATHIST_BUCKETS - 1; b++) {
+        seen += h->buckets[b];
+        if (seen && seen >= rank)
+            break;
+    }
+    const uint64_t edge = lathist_edge(b);
+    return edge < h->max_ns ? edge : h->max_ns;
+}
+
+#endif
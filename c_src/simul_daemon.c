@@ -0,0 +1,1450 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <glob.h>
+#include <linux/filter.h>
+#include <linux/input.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chord.h"
+#include "evbatch.h"
+#include "keymap.h"
+#include "lathist.h"
+#include "spsc.h"
+#ifdef SIMUL_STATIC_RULES
+#include "chord_rules.h"
+#include "chord_static.h"
+#endif
+
+// Goal of this program:
+// Same as `simul_three.c` but for many devices in a single process.
+// Every device given on the command line (paths or glob patterns, e.g.
+// '/dev/input/by-id/*-event-kbd', or '-' for stdin) is grabbed and gets its
+// own chord state, all of them are multiplexed on one epoll loop with one
+// timerfd armed at the earliest pending deadline. Devices appearing later are
+// picked up through the kernel's uevent netlink socket, devices disappearing
+// are dropped. The merged output stream is written to stdout, e.g. for
+// `uinput`.
+//
+// With `-m` all devices share a single chord state instead, so a chord can
+// span devices (split keyboards, foot pedals, ...). Key frames (events up to
+// and including SYN_REPORT) of all devices are then merged in kernel
+// timestamp order through a small, bounded reorder window (`-w`, in us).
+// Frames without key events never enter the window and are written right
+// away, so a chatty pointer device can't delay keyboard events.
+//
+// With `-t` the work is split over two threads: an input thread that only
+// reads devices (and stamps the arrival time of every read), and the
+// decision thread running the chord engine, timers and output. Reads are
+// handed over in place through a lock-free SPSC ring of batches, so a slow
+// stdout never stops the devices from being drained and a burst of input
+// never delays a deadline flush.
+//
+// With `-k` the chord tables come from a keymap image made by `simul_keymap`
+// instead of `chord_rules.h`: it is mapped read-only and used in place, so
+// rules change without a rebuild and start up builds no tables at all.
+//
+// Output never blocks the decision loop on a slow consumer: stdout is
+// nonblocking, whatever it doesn't take right away goes into a bounded queue
+// that is written out once stdout is writable again. If the queue fills up,
+// key repeats and empty frames are dropped to make room, and with `-p drop`
+// (the default, `-p keep` to keep them) non-key events like pointer motion
+// too, with an alert on stderr. Key presses and releases are never dropped,
+// for those the daemon waits until there is room.
+//
+// While idle the daemon doesn't wake up at all: the timerfd is only armed
+// while a press is held back (one deadline, the earliest), and the uevent
+// socket filters out everything but input device additions in the kernel.
+// SIGUSR1 writes the wakeup counters (and other stats) to stderr.
+//
+// `-l BUDGET_US` times every key press and release written, from the kernel
+// timestamp of the input that caused it (the chord engine keeps that on
+// what it writes) until stdout took it. Rolling histograms over the last
+// minute or two, per kind of key (passed through, swallowed then flushed,
+// chord target), are part of the SIGUSR1 stats, and keys passed through
+// over the budget are reported on stderr. Input from stdin has to carry
+// CLOCK_MONOTONIC timestamps for this (devices are switched to it).
+//
+// Code below is split in 'input side' (device fds, hotplug) and 'decision
+// side' (chord state, timer, output). Without `-t` both run on the main
+// thread, with `-t` the input side runs on its own thread.
+
+////////////////////////////////////////////////////////////////////////////////
+// APPLICATION CONSTANTS
+////////////////////////////////////////////////////////////////////////////////
+#define err_exit(msg)       \
+    {                       \
+        perror(msg);        \
+        exit(EXIT_FAILURE); \
+    }
+#define MAX_DEVICES 64
+#define EPOLL_IDX_TIMER MAX_DEVICES
+#define EPOLL_IDX_UEVENT (MAX_DEVICES + 1)
+#define EPOLL_IDX_WAKE (MAX_DEVICES + 2)
+#define EPOLL_IDX_SIGNAL (MAX_DEVICES + 3)
+#define EPOLL_IDX_OUTPUT (MAX_DEVICES + 4)
+#define EPOLL_EVENTS (MAX_DEVICES + 5)
+#define READ_EVENTS 64
+#define OUT_EVENTS (READ_EVENTS * CHORD_MAX_OUT)
+#define OUT_IOVS (4 * READ_EVENTS)
+#define UEVENT_BUF_SIZE 8192
+#define FRAME_EVENTS 16
+#define MERGE_FRAMES 128
+#define RING_BATCHES 64  // Power of two
+#define OUTQ_EVENTS 8192  // Power of two
+// Key samples not written yet: queued ones plus what one flush can take
+#define LAT_SAMPLES_MAX 16384  // Power of two
+#define LAT_WINDOW_NS (60 * 1000000000ull)
+#define STDIN_PATTERN "-"
+#define KEY_PRESSED 1
+#define KEY_REPEATED 2
+
+struct frame {
+    uint64_t time;  // Kernel timestamp of the frame's first event
+    uint8_t device;
+    uint8_t num_events;
+    bool has_key;
+    struct input_event events[FRAME_EVENTS];
+};
+
+// Unit of work handed from the input side to the decision side
+enum batch_kind { BATCH_EVENTS, BATCH_ADDED, BATCH_REMOVED };
+struct batch {
+    uint8_t kind;
+    uint8_t device;
+    // Event times of evdev devices are on our clock (see `add_device`),
+    // anything else (stdin) uses the time it was read at instead
+    bool is_evdev;
+    uint64_t arrival;
+    size_t count;
+    struct input_event events[READ_EVENTS];
+};
+
+struct device {
+    // Input side
+    int fd;  // -1 when the slot is free
+    dev_t rdev;
+    bool is_evdev;
+    // Pipes can end a read halfway through an event, keep that part
+    uint8_t num_partial;
+    char partial[sizeof(struct input_event)];
+    // Decision side
+    bool active;
+    struct chord_state chord;
+    struct frame frame;  // Frame being read, only used with `-m`
+    size_t num_queued;   // Its frames in MERGE_QUEUE
+    // Keys it holds down, so they can be let go when it is removed (without
+    // `-m`, see KEY_DEVICE otherwise)
+    uint64_t keys_down[(KEY_CNT + 63) / 64];
+};
+
+// Built with `-DSIMUL_STATIC_RULES` the rules of `chord_rules.h` are compiled
+// into the engine (`chord_static.h`) instead of looked up at runtime
+#ifdef SIMUL_STATIC_RULES
+CHORD_STATIC_ENGINE(simul, SIMUL_THRESHOLD, SIMUL_RULES)
+#define ENGINE_CONFIG (&simul_config)
+#define engine_feed(st, event, now, out) simul_feed(st, event, now, out)
+#define engine_expire(st, now, out) simul_expire(st, now, out)
+#define engine_reset(st, out) simul_reset(st, out)
+#else
+// Points into the keymap image with `-k`, at BUILT_CONFIG otherwise
+static const struct chord_config *CONFIG;
+static struct chord_config BUILT_CONFIG;
+#define ENGINE_CONFIG CONFIG
+#define engine_feed(st, event, now, out) \
+    chord_feed(CONFIG, st, event, now, out)
+#define engine_expire(st, now, out) chord_expire(CONFIG, st, now, out)
+#define engine_reset(st, out) chord_reset(CONFIG, st, out)
+#endif
+static const struct evbatch_keyset *SOURCE_KEYS;
+static struct evbatch_keyset BUILT_SOURCE_KEYS;
+static struct device DEVICES[MAX_DEVICES];
+static char **PATTERNS;
+static int NUM_PATTERNS;
+static bool STDIN_USED;
+static int INPUT_EPOLL_FD;
+static int DECISION_EPOLL_FD;
+static int TIMER_FD;
+static int UEVENT_FD;
+static int SIGNAL_FD;
+static uint64_t TIMER_DEADLINE = CHORD_NO_DEADLINE;
+
+// Cross-device mode (`-m`)
+static bool MERGE;
+static uint64_t MERGE_WINDOW_NS;
+static struct chord_state MERGED_CHORD;
+// Ring of key frames waiting out the reorder window, sorted by `time`.
+// Only ever touched by the decision side, so no locking needed.
+static struct frame MERGE_QUEUE[MERGE_FRAMES];
+static size_t MERGE_HEAD;
+static size_t MERGE_LEN;
+// Device (index + 1) whose press of a key the shared chord state got, 0 once
+// released, so the keys of a device can be let go when it is removed
+static uint8_t KEY_DEVICE[KEY_CNT];
+
+// Two thread mode (`-t`)
+static bool THREADED;
+static struct spsc RING;
+static struct batch RING_BATCH[RING_BATCHES];
+static int WAKE_FD;  // eventfd, input side -> decision side
+static bool WAKE_PENDING;
+// eventfd, decision side -> input side: room in the ring again, only
+// written while the input side waits for it
+static int ROOM_FD;
+static atomic_bool ROOM_WANTED;
+static struct batch LOCAL_BATCH;  // Used instead of the ring without `-t`
+
+// Instrumentation, written to stderr on SIGUSR1. Every loop only counts its
+// own wakeups, so plain relaxed atomics are enough.
+struct stats {
+    atomic_uint_fast64_t wakeups[2];  // Returns of epoll_wait, input/decision
+                                      // loop (SIGUSR1 alone doesn't count)
+    atomic_uint_fast64_t timer_arms;
+    atomic_uint_fast64_t timer_fires;
+    atomic_uint_fast64_t queue_max;        // Most events ever queued
+    atomic_uint_fast64_t dropped_redundant;  // Repeats, empty frames
+    atomic_uint_fast64_t dropped_non_key;
+    atomic_uint_fast64_t blocked;  // Times a key had to wait for room
+};
+static struct stats STATS;
+
+// Output is gathered as a list of iovecs: events written by the chord engine
+// live in `OUT`, events passed through untouched are referenced right where
+// they were read, so pointer traffic is never copied
+static struct input_event OUT[OUT_EVENTS];
+static size_t NUM_OUT;
+static struct iovec IOV[OUT_IOVS];
+static int NUM_IOV;
+
+// Output stdout didn't take yet (see top), a ring starting at OUTQ_HEAD of
+// which the first OUTQ_SENT bytes are written already
+static struct input_event OUTQ[OUTQ_EVENTS];
+static size_t OUTQ_HEAD;
+static size_t OUTQ_LEN;
+static size_t OUTQ_SENT;
+static bool OUTQ_POLLING;   // stdout is in the epoll set, for EPOLLOUT
+static bool OUTQ_STALLED;   // Dropping, alerted on stderr
+static bool DROP_NON_KEY = true;
+static size_t OUTQ_KEYS;    // Key presses/releases queued (`-l` only)
+
+// Latency self-test (`-l`): a sample per key press/release in output order,
+// waiting to be written. The last OUTQ_KEYS of them are queued, as those
+// never get dropped the two stay in step.
+enum lat_class { LAT_PASS, LAT_FLUSHED, LAT_CHORD, LAT_CLASSES };
+static const char *const LAT_CLASS_NAMES[LAT_CLASSES] = {
+    "passed through", "flushed", "chord target"};
+struct lat_sample {
+    uint64_t time;  // Of the input event that caused it
+    uint16_t code;
+    uint8_t cls;
+};
+static bool LATENCY;
+static uint64_t LAT_BUDGET_NS;
+static struct lat_sample LAT_SAMPLES[LAT_SAMPLES_MAX];
+static size_t LAT_HEAD;
+static size_t LAT_LEN;
+// Rolling: the current window and the one before, reported together
+static struct lathist LAT_HIST[2][LAT_CLASSES];
+static int LAT_WINDOW;
+static uint64_t LAT_WINDOW_START;
+static uint64_t LAT_OVER_BUDGET;
+static uint64_t LAT_LAST_ALERT;
+
+////////////////////////////////////////////////////////////////////////////////
+// TIME UTILS
+////////////////////////////////////////////////////////////////////////////////
+static inline uint64_t timeval_to_ns(const struct timeval *tv) {
+    return (uint64_t)tv->tv_sec * 1000000000 + (uint64_t)tv->tv_usec * 1000;
+}
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint64_t event_ns(const struct batch *b,
+                                const struct input_event *event) {
+    return b->is_evdev ? timeval_to_ns(&event->time) : b->arrival;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// LATENCY UTILS (decision side)
+////////////////////////////////////////////////////////////////////////////////
+static inline bool is_key_edge(const struct input_event *event) {
+    return event->type == EV_KEY && event->value != KEY_REPEATED;
+}
+
+// `cause` is the event the chord engine was fed (NULL if none): it passes
+// through itself, any other key it wrote is a flushed source key press (e.g.
+// on the release of that key) or a chord target
+static void lat_note(const struct input_event *events, size_t count,
+                     const struct input_event *cause, enum lat_class cls) {
+    size_t i;
+    for (i = 0; i < count; i++) {
+        const struct input_event *event = &events[i];
+        if (!is_key_edge(event))
+            continue;
+        struct lat_sample *sample =
+            &LAT_SAMPLES[(LAT_HEAD + LAT_LEN++) & (LAT_SAMPLES_MAX - 1)];
+        sample->time = timeval_to_ns(&event->time);
+        sample->code = event->code;
+        sample->cls  = cls;
+        if (cause &&
+            (event->code != cause->code || event->value != cause->value))
+            sample->cls = event->value == KEY_PRESSED &&
+                                  evbatch_keyset_has(SOURCE_KEYS, event->code)
+                              ? LAT_FLUSHED
+                              : LAT_CHORD;
+    }
+}
+
+static void lat_record(const struct lat_sample *sample, uint64_t now) {
+    // No time (written on reset), or not on our clock
+    if (!sample->time || sample->time > now)
+        return;
+    if (now - LAT_WINDOW_START >= LAT_WINDOW_NS) {
+        int c;
+        LAT_WINDOW ^= 1;
+        for (c = 0; c < LAT_CLASSES; c++) {
+            lathist_clear(&LAT_HIST[LAT_WINDOW][c]);
+            if (now - LAT_WINDOW_START >= 2 * LAT_WINDOW_NS)
+                lathist_clear(&LAT_HIST[!LAT_WINDOW][c]);
+        }
+        LAT_WINDOW_START = now;
+    }
+    const uint64_t ns = now - sample->time;
+    lathist_add(&LAT_HIST[LAT_WINDOW][sample->cls], ns);
+    if (sample->cls != LAT_PASS || ns <= LAT_BUDGET_NS)
+        return;
+    LAT_OVER_BUDGET++;
+    // At most a line a second, the stats count all of them
+    if (now - LAT_LAST_ALERT >= 1000000000) {
+        fprintf(stderr,
+                "Key %u passed through in %.3fms, over the %.3fms budget "
+                "(%lu times so far)\n",
+                sample->code, ns / 1e6, LAT_BUDGET_NS / 1e6,
+                (unsigned long)LAT_OVER_BUDGET);
+        LAT_LAST_ALERT = now;
+    }
+}
+
+// Everything noted but still queued has been written by now
+static void lat_written(void) {
+    if (LAT_LEN == OUTQ_KEYS)
+        return;
+    const uint64_t now = now_ns();
+    for (; LAT_LEN > OUTQ_KEYS; LAT_HEAD++, LAT_LEN--)
+        lat_record(&LAT_SAMPLES[LAT_HEAD & (LAT_SAMPLES_MAX - 1)], now);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// OUTPUT UTILS (decision side)
+////////////////////////////////////////////////////////////////////////////////
+static inline struct input_event *outq_at(size_t i) {
+    return &OUTQ[(OUTQ_HEAD + i) & (OUTQ_EVENTS - 1)];
+}
+
+static inline bool is_syn_report(const struct input_event *event) {
+    return event->type == EV_SYN && event->code == SYN_REPORT;
+}
+
+// What may go when the queue is full: repeats (the consumer's own autorepeat
+// keeps going anyway), a frame left empty (SYN_REPORT after SYN_REPORT) and,
+// unless `-p keep`, non-key events
+static bool outq_droppable(const struct input_event *prev,
+                           const struct input_event *event) {
+    bool drop = false;
+    if (event->type == EV_KEY) {
+        if ((drop = event->value == KEY_REPEATED))
+            atomic_fetch_add_explicit(&STATS.dropped_redundant, 1,
+                                      memory_order_relaxed);
+    } else if (is_syn_report(event)) {
+        if ((drop = prev && is_syn_report(prev)))
+            atomic_fetch_add_explicit(&STATS.dropped_redundant, 1,
+                                      memory_order_relaxed);
+    } else if ((drop = DROP_NON_KEY && event->type != EV_SYN)) {
+        atomic_fetch_add_explicit(&STATS.dropped_non_key, 1,
+                                  memory_order_relaxed);
+    }
+    if (drop && !OUTQ_STALLED) {
+        fprintf(stderr, "Output stalled, dropping redundant%s events\n",
+                DROP_NON_KEY ? " and non-key" : "");
+        OUTQ_STALLED = true;
+    }
+    return drop;
+}
+
+// Writes as much of the queue as stdout takes without blocking
+static void outq_drain(void) {
+    while (OUTQ_LEN) {
+        const size_t head   = OUTQ_HEAD & (OUTQ_EVENTS - 1);
+        const size_t first  = OUTQ_EVENTS - head < OUTQ_LEN ? OUTQ_EVENTS - head
+                                                            : OUTQ_LEN;
+        struct iovec iov[2] = {
+            {.iov_base = (char *)&OUTQ[head] + OUTQ_SENT,
+             .iov_len  = first * sizeof(struct input_event) - OUTQ_SENT},
+            {.iov_base = OUTQ,
+             .iov_len  = (OUTQ_LEN - first) * sizeof(struct input_event)},
+        };
+        ssize_t written = writev(STDOUT_FILENO, iov, iov[1].iov_len ? 2 : 1);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                return;
+            err_exit("Failed on writev");
+        }
+        OUTQ_SENT += written;
+        const size_t done = OUTQ_SENT / sizeof(struct input_event);
+        size_t i;
+        if (LATENCY)
+            for (i = 0; i < done; i++)
+                OUTQ_KEYS -= is_key_edge(outq_at(i));
+        OUTQ_HEAD += done;
+        OUTQ_LEN -= done;
+        OUTQ_SENT %= sizeof(struct input_event);
+    }
+    if (OUTQ_STALLED) {
+        fprintf(stderr,
+                "Output caught up, dropped %lu redundant and %lu non-key "
+                "events so far\n",
+                (unsigned long)STATS.dropped_redundant,
+                (unsigned long)STATS.dropped_non_key);
+        OUTQ_STALLED = false;
+    }
+}
+
+// Drops what may be dropped from the queue (not the partly written head)
+static void outq_compact(void) {
+    size_t from = OUTQ_SENT ? 1 : 0, to = from;
+    for (; from < OUTQ_LEN; from++) {
+        const struct input_event *event = outq_at(from);
+        if (!outq_droppable(to ? outq_at(to - 1) : NULL, event))
+            *outq_at(to++) = *event;
+    }
+    OUTQ_LEN = to;
+}
+
+// Blocks until at most `len` events are queued
+static void outq_wait(size_t len) {
+    while (OUTQ_LEN > len) {
+        struct pollfd pfd = {.fd = STDOUT_FILENO, .events = POLLOUT};
+        if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+            err_exit("Failed on poll");
+        outq_drain();
+    }
+}
+
+static void outq_push(const struct input_event *event) {
+    if (OUTQ_LEN == OUTQ_EVENTS) {
+        if (outq_droppable(outq_at(OUTQ_LEN - 1), event))
+            return;
+        outq_compact();
+        // Only for events that can't be dropped
+        if (OUTQ_LEN == OUTQ_EVENTS) {
+            atomic_fetch_add_explicit(&STATS.blocked, 1, memory_order_relaxed);
+            outq_wait(OUTQ_EVENTS - 1);
+        }
+    }
+    *outq_at(OUTQ_LEN++) = *event;
+    if (LATENCY)
+        OUTQ_KEYS += is_key_edge(event);
+    if (OUTQ_LEN > STATS.queue_max)
+        atomic_store_explicit(&STATS.queue_max, OUTQ_LEN,
+                              memory_order_relaxed);
+}
+
+// EPOLLOUT only while something is queued, so an idle daemon never wakes up.
+// A stdout that can't be polled (regular file) never blocks for long anyway.
+static void outq_poll_update(void) {
+    if (OUTQ_LEN && !OUTQ_POLLING) {
+        struct epoll_event ev = {.events   = EPOLLOUT,
+                                 .data.u32 = EPOLL_IDX_OUTPUT};
+        if (epoll_ctl(DECISION_EPOLL_FD, EPOLL_CTL_ADD, STDOUT_FILENO, &ev) ==
+            0)
+            OUTQ_POLLING = true;
+        else if (errno == EPERM)
+            outq_wait(0);
+        else
+            err_exit("Failed on epoll_ctl");
+    } else if (!OUTQ_LEN && OUTQ_POLLING) {
+        if (epoll_ctl(DECISION_EPOLL_FD, EPOLL_CTL_DEL, STDOUT_FILENO, NULL) ==
+            -1)
+            err_exit("Failed on epoll_ctl");
+        OUTQ_POLLING = false;
+    }
+}
+
+static void handle_output(void) {
+    outq_drain();
+    outq_poll_update();
+}
+
+static void flush_out(void) {
+    struct iovec *iov = IOV;
+    int left          = NUM_IOV;
+    // Straight to stdout as long as nothing is queued (order!)
+    while (left && !OUTQ_LEN) {
+        ssize_t written = writev(STDOUT_FILENO, iov, left);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            err_exit("Failed on writev");
+        }
+        // Skip what got written, a partial write can end mid-iovec
+        while (left && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++, left--;
+        }
+        if (left) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    // The rest is queued, iovecs point into buffers about to be reused
+    for (; left; iov++, left--) {
+        // Only the first one can start in the middle of an event
+        const size_t sent = (sizeof(struct input_event) -
+                             iov->iov_len % sizeof(struct input_event)) %
+                            sizeof(struct input_event);
+        const struct input_event *events =
+            (const struct input_event *)((char *)iov->iov_base - sent);
+        const size_t count = (iov->iov_len + sent) / sizeof(struct input_event);
+        size_t i;
+        for (i = 0; i < count; i++)
+            outq_push(&events[i]);
+        if (sent)
+            OUTQ_SENT = sent;  // Queue was empty, this is the head
+    }
+    if (OUTQ_LEN) {
+        outq_drain();
+        outq_poll_update();
+    }
+    NUM_OUT = 0;
+    NUM_IOV = 0;
+    if (LATENCY)
+        lat_written();
+}
+
+// Makes sure the next engine call has room for its worst case output
+static inline struct input_event *out_reserve(void) {
+    if (NUM_OUT + CHORD_MAX_OUT > OUT_EVENTS || NUM_IOV == OUT_IOVS)
+        flush_out();
+    return OUT + NUM_OUT;
+}
+
+// Adds the `count` events written at `out_reserve()` to the output, `cause`
+// and `cls` as for `lat_note`
+static inline void out_commit(size_t count, const struct input_event *cause,
+                              enum lat_class cls) {
+    if (!count)
+        return;
+    if (LATENCY)
+        lat_note(OUT + NUM_OUT, count, cause, cls);
+    struct iovec *last = NUM_IOV ? &IOV[NUM_IOV - 1] : NULL;
+    if (last && (char *)last->iov_base + last->iov_len == (char *)(OUT + NUM_OUT))
+        last->iov_len += count * sizeof(struct input_event);
+    else
+        IOV[NUM_IOV++] = (struct iovec){
+            .iov_base = OUT + NUM_OUT,
+            .iov_len  = count * sizeof(struct input_event)};
+    NUM_OUT += count;
+}
+
+// Forwards `events` without copying, they have to stay valid until the next
+// `flush_out`
+static inline void out_forward(const struct input_event *events,
+                               size_t count) {
+    if (NUM_IOV == OUT_IOVS)
+        flush_out();
+    IOV[NUM_IOV++] = (struct iovec){
+        .iov_base = (void *)events,
+        .iov_len  = count * sizeof(struct input_event)};
+    if (LATENCY)
+        lat_note(events, count, NULL, LAT_PASS);
+}
+
+// Same as `out_forward` for events in a buffer that is about to be reused
+static inline void out_copy(const struct input_event *events, size_t count) {
+    memcpy(out_reserve(), events, count * sizeof(struct input_event));
+    out_commit(count, NULL, LAT_PASS);
+}
+
+// Events are forwarded from the batch itself, see `out_forward`
+static inline void feed_events(struct chord_state *chord,
+                               const struct batch *b) {
+    size_t i = 0;
+    while (i < b->count) {
+        // Whole runs of non-key events skip the chord engine, and so do
+        // other keys while no source key press is held back
+        const uint64_t deadline = chord_next_deadline(chord);
+        size_t run =
+            deadline == CHORD_NO_DEADLINE
+                ? evbatch_skip_non_source(b->events + i, b->count - i,
+                                          SOURCE_KEYS)
+                : evbatch_skip_non_key(b->events + i, b->count - i);
+        if (run && deadline != CHORD_NO_DEADLINE) {
+            // Presses held back past their deadline go before the events
+            // stamped after it, as if the timer had fired in between
+            size_t j;
+            for (j = 0; j < run && event_ns(b, &b->events[i + j]) < deadline;
+                 j++)
+                ;
+            if (!j) {
+                out_commit(engine_expire(chord, event_ns(b, &b->events[i]),
+                                         out_reserve()),
+                           NULL, LAT_FLUSHED);
+                continue;
+            }
+            run = j;
+        }
+        if (run) {
+            out_forward(b->events + i, run);
+            i += run;
+            continue;
+        }
+        out_commit(engine_feed(chord, &b->events[i],
+                               event_ns(b, &b->events[i]), out_reserve()),
+                   &b->events[i], LAT_PASS);
+        i++;
+    }
+}
+
+// Only key events are looked at, runs of anything else are skipped over
+static inline void track_keys(struct device *dev, const struct batch *b) {
+    size_t i = 0;
+    while ((i += evbatch_skip_non_key(b->events + i, b->count - i)) <
+           b->count) {
+        const struct input_event *event = &b->events[i++];
+        if (!is_key_edge(event) || event->code >= KEY_CNT)
+            continue;
+        const uint64_t bit = (uint64_t)1 << (event->code % 64);
+        if (event->value)
+            dev->keys_down[event->code / 64] |= bit;
+        else
+            dev->keys_down[event->code / 64] &= ~bit;
+    }
+}
+
+// Like `merge_remove` for a device's own chord state: swallowed presses are
+// forgotten, anything written already is released (targets of its chords
+// included)
+static void release_keys(struct device *dev) {
+    const uint64_t now = now_ns();
+    bool released      = false;
+    int code;
+    for (code = 0; code < KEY_CNT; code++) {
+        const uint64_t bit = (uint64_t)1 << (code % 64);
+        if (!(dev->keys_down[code / 64] & bit))
+            continue;
+        dev->keys_down[code / 64] &= ~bit;
+        if (chord_drop_pending(&dev->chord, code))
+            continue;
+        // No time, like `chord_reset`
+        const struct input_event release = {
+            .type = EV_KEY, .code = code, .value = 0};
+        out_commit(engine_feed(&dev->chord, &release, now, out_reserve()),
+                   &release, LAT_PASS);
+        released = true;
+    }
+    if (released) {
+        const struct input_event syn = {.type = EV_SYN, .code = SYN_REPORT};
+        out_copy(&syn, 1);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// MERGE UTILS (decision side)
+////////////////////////////////////////////////////////////////////////////////
+static inline struct frame *merge_at(size_t i) {
+    return &MERGE_QUEUE[(MERGE_HEAD + i) % MERGE_FRAMES];
+}
+
+static inline void merge_pop(void) {
+    const struct frame *f = merge_at(0);
+    uint8_t i;
+    if (!f->has_key)
+        out_copy(f->events, f->num_events);
+    else
+        for (i = 0; i < f->num_events; i++) {
+            const struct input_event *event = &f->events[i];
+            if (is_key_edge(event) && event->code < KEY_CNT)
+                KEY_DEVICE[event->code] = event->value ? f->device + 1 : 0;
+            out_commit(
+                engine_feed(&MERGED_CHORD, event, f->time, out_reserve()),
+                event, LAT_PASS);
+        }
+    DEVICES[f->device].num_queued--;
+    MERGE_HEAD = (MERGE_HEAD + 1) % MERGE_FRAMES;
+    MERGE_LEN--;
+}
+
+// Insertion from the back, frames almost always arrive in order already
+static void merge_push(const struct frame *f) {
+    if (MERGE_LEN == MERGE_FRAMES)
+        merge_pop();  // Bounded: the oldest frame has waited long enough
+    size_t i = MERGE_LEN++;
+    while (i && merge_at(i - 1)->time > f->time) {
+        *merge_at(i) = *merge_at(i - 1);
+        i--;
+    }
+    *merge_at(i) = *f;
+    DEVICES[f->device].num_queued++;
+}
+
+static void merge_release(uint64_t now) {
+    while (MERGE_LEN && merge_at(0)->time + MERGE_WINDOW_NS <= now)
+        merge_pop();
+}
+
+// Chord deadlines can't be handled past a frame still in the window, that
+// frame might be the one completing the chord
+static inline uint64_t merge_horizon(uint64_t now) {
+    return MERGE_LEN && merge_at(0)->time < now ? merge_at(0)->time : now;
+}
+
+// A removed device's frames still in the window are dropped, and its keys
+// in the shared chord state let go of: swallowed presses are forgotten,
+// anything written already is released (targets of its chords included)
+static void merge_remove(int idx) {
+    size_t from, to = 0;
+    for (from = 0; from < MERGE_LEN; from++)
+        if (merge_at(from)->device != idx)
+            *merge_at(to++) = *merge_at(from);
+    MERGE_LEN                     = to;
+    DEVICES[idx].num_queued       = 0;
+    DEVICES[idx].frame.num_events = 0;
+
+    const uint64_t now = merge_horizon(now_ns());
+    bool released      = false;
+    int code;
+    for (code = 0; code < KEY_CNT; code++) {
+        if (KEY_DEVICE[code] != idx + 1)
+            continue;
+        KEY_DEVICE[code] = 0;
+        if (chord_drop_pending(&MERGED_CHORD, code))
+            continue;
+        // No time, like `chord_reset`
+        const struct input_event release = {
+            .type = EV_KEY, .code = code, .value = 0};
+        out_commit(engine_feed(&MERGED_CHORD, &release, now, out_reserve()),
+                   &release, LAT_PASS);
+        released = true;
+    }
+    if (released) {
+        const struct input_event syn = {.type = EV_SYN, .code = SYN_REPORT};
+        out_copy(&syn, 1);
+    }
+}
+
+// Frames without keys skip the window, unless that would pass a frame of
+// their device still in it (e.g. motion right after a button press)
+static void submit_frame(struct frame *f) {
+    if (f->has_key || DEVICES[f->device].num_queued)
+        merge_push(f);
+    else
+        out_copy(f->events, f->num_events);
+    f->num_events = 0;
+    f->has_key    = false;
+}
+
+// Splits a device's events into frames for the reorder window
+static void read_frames(struct device *dev, const struct batch *b) {
+    struct frame *f = &dev->frame;
+    size_t i;
+    for (i = 0; i < b->count; i++) {
+        if (!f->num_events) {
+            f->time   = event_ns(b, &b->events[i]);
+            f->device = b->device;
+        }
+        f->events[f->num_events++] = b->events[i];
+        if (b->events[i].type == EV_KEY)
+            f->has_key = true;
+        if ((b->events[i].type == EV_SYN &&
+             b->events[i].code == SYN_REPORT) ||
+            f->num_events == FRAME_EVENTS)
+            submit_frame(f);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// TIMER UTILS (decision side)
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t next_deadline(void) {
+    uint64_t deadline = CHORD_NO_DEADLINE;
+    if (MERGE) {
+        deadline = chord_next_deadline(&MERGED_CHORD);
+        if (MERGE_LEN) {
+            const uint64_t head = merge_at(0)->time;
+            if (deadline > head)
+                deadline = head + MERGE_WINDOW_NS;
+        }
+        return deadline;
+    }
+    int i;
+    for (i = 0; i < MAX_DEVICES; i++) {
+        if (!DEVICES[i].active)
+            continue;
+        uint64_t d = chord_next_deadline(&DEVICES[i].chord);
+        if (d < deadline)
+            deadline = d;
+    }
+    return deadline;
+}
+
+// Only a single timer for all devices, armed at the earliest deadline
+static void timer_update(void) {
+    const uint64_t deadline = next_deadline();
+    if (deadline == TIMER_DEADLINE)
+        return;
+
+    // All zero disarms the timer
+    struct itimerspec its = {0};
+    if (deadline != CHORD_NO_DEADLINE) {
+        its.it_value.tv_sec  = deadline / 1000000000;
+        its.it_value.tv_nsec = deadline % 1000000000;
+        // A zero value would disarm, deadline is already due anyway
+        if (!its.it_value.tv_sec && !its.it_value.tv_nsec)
+            its.it_value.tv_nsec = 1;
+    }
+    if (timerfd_settime(TIMER_FD, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+        err_exit("Failed on timerfd_settime");
+    if (deadline != CHORD_NO_DEADLINE)
+        atomic_fetch_add_explicit(&STATS.timer_arms, 1, memory_order_relaxed);
+    TIMER_DEADLINE = deadline;
+}
+
+static void handle_timer(void) {
+    uint64_t expirations;
+    if (read(TIMER_FD, &expirations, sizeof(expirations)) == -1 &&
+        errno != EAGAIN)
+        err_exit("Failed on read timerfd");
+    TIMER_DEADLINE = CHORD_NO_DEADLINE;
+    atomic_fetch_add_explicit(&STATS.timer_fires, 1, memory_order_relaxed);
+
+    const uint64_t now = now_ns();
+    if (MERGE) {
+        merge_release(now);
+        out_commit(engine_expire(&MERGED_CHORD, merge_horizon(now),
+                                 out_reserve()),
+                   NULL, LAT_FLUSHED);
+        return;
+    }
+    int i;
+    for (i = 0; i < MAX_DEVICES; i++) {
+        if (!DEVICES[i].active)
+            continue;
+        out_commit(engine_expire(&DEVICES[i].chord, now, out_reserve()), NULL,
+                   LAT_FLUSHED);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// BATCH HANDLING (decision side)
+////////////////////////////////////////////////////////////////////////////////
+static void process_batch(const struct batch *b) {
+    struct device *dev = &DEVICES[b->device];
+    switch (b->kind) {
+        case BATCH_ADDED:
+            dev->active           = true;
+            dev->frame.num_events = 0;
+            dev->frame.has_key    = false;
+            memset(dev->keys_down, 0, sizeof(dev->keys_down));
+            chord_state_init(&dev->chord);
+            break;
+        case BATCH_REMOVED:
+            // Don't leave a key stuck down when its device goes away, a
+            // shared chord state lives on with the other devices
+            if (!MERGE) {
+                if (b->is_evdev)
+                    release_keys(dev);
+                out_commit(engine_reset(&dev->chord, out_reserve()), NULL,
+                           LAT_CHORD);
+            } else if (b->is_evdev)
+                merge_remove(b->device);
+            dev->active = false;
+            // Like the other filters, we are done once stdin is
+            if (!b->is_evdev) {
+                if (MERGE)
+                    merge_release(CHORD_NO_DEADLINE);
+                flush_out();
+                outq_wait(0);
+                exit(EXIT_SUCCESS);
+            }
+            break;
+        default:
+            if (MERGE) {
+                read_frames(dev, b);
+                break;
+            }
+            if (b->is_evdev)
+                track_keys(dev, b);
+            feed_events(&dev->chord, b);
+            break;
+    }
+    // Forwarded events point into the batch, which is reused after this
+    flush_out();
+}
+
+// Drains everything the input thread handed over (`-t` only)
+static void handle_wake(void) {
+    uint64_t count;
+    if (read(WAKE_FD, &count, sizeof(count)) == -1 && errno != EAGAIN)
+        err_exit("Failed on read eventfd");
+    size_t slot;
+    while ((slot = spsc_consume_slot(&RING)) != SPSC_EMPTY) {
+        process_batch(&RING_BATCH[slot]);
+        spsc_consume(&RING);
+        // Pairs with the fence in `batch_begin`: either it sees the slot
+        // free, or we see it waiting
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&ROOM_WANTED, memory_order_relaxed) &&
+            atomic_exchange(&ROOM_WANTED, false)) {
+            const uint64_t one = 1;
+            if (write(ROOM_FD, &one, sizeof(one)) == -1 && errno != EAGAIN)
+                err_exit("Failed on write eventfd");
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// STATS (decision side)
+////////////////////////////////////////////////////////////////////////////////
+static void print_stats(void) {
+    fprintf(stderr,
+            "stats: wakeups %lu (input %lu, decision %lu), timer armed %lu, "
+            "fired %lu, output queued %lu (max %lu), dropped %lu redundant and "
+            "%lu non-key events, blocked %lu times\n",
+            (unsigned long)(STATS.wakeups[0] + STATS.wakeups[1]),
+            (unsigned long)STATS.wakeups[0], (unsigned long)STATS.wakeups[1],
+            (unsigned long)STATS.timer_arms, (unsigned long)STATS.timer_fires,
+            (unsigned long)OUTQ_LEN, (unsigned long)STATS.queue_max,
+            (unsigned long)STATS.dropped_redundant,
+            (unsigned long)STATS.dropped_non_key,
+            (unsigned long)STATS.blocked);
+    if (!LATENCY)
+        return;
+    int c;
+    for (c = 0; c < LAT_CLASSES; c++) {
+        struct lathist h = LAT_HIST[0][c];
+        lathist_merge(&h, &LAT_HIST[1][c]);
+        fprintf(stderr,
+                "latency %s: %lu keys, mean %.3fms, p50 %.3fms, p99 %.3fms, "
+                "max %.3fms",
+                LAT_CLASS_NAMES[c], (unsigned long)h.count,
+                h.count ? h.sum_ns / 1e6 / h.count : 0.0,
+                lathist_quantile(&h, 500) / 1e6,
+                lathist_quantile(&h, 990) / 1e6, h.max_ns / 1e6);
+        if (c == LAT_PASS)
+            fprintf(stderr, ", %lu over the %.3fms budget",
+                    (unsigned long)LAT_OVER_BUDGET, LAT_BUDGET_NS / 1e6);
+        fputc('\n', stderr);
+    }
+}
+
+static void handle_signal(void) {
+    struct signalfd_siginfo info;
+    while (read(SIGNAL_FD, &info, sizeof(info)) == sizeof(info))
+        if (info.ssi_signo == SIGUSR1)
+            print_stats();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// BATCH HANDOFF (input side)
+////////////////////////////////////////////////////////////////////////////////
+static void wake_decision(void) {
+    const uint64_t one = 1;
+    if (write(WAKE_FD, &one, sizeof(one)) == -1 && errno != EAGAIN)
+        err_exit("Failed on write eventfd");
+    WAKE_PENDING = false;
+}
+
+// Batch to read into, directly a ring slot with `-t`
+static struct batch *batch_begin(void) {
+    if (!THREADED)
+        return &LOCAL_BATCH;
+    size_t slot;
+    while ((slot = spsc_produce_slot(&RING)) == SPSC_FULL) {
+        // Decision side is behind (e.g. stdout is blocked), stop reading
+        // until it made room, events queue up in the kernel meanwhile. Asleep,
+        // not spinning, it may take a while.
+        if (WAKE_PENDING)
+            wake_decision();
+        atomic_store(&ROOM_WANTED, true);
+        atomic_thread_fence(memory_order_seq_cst);
+        if ((slot = spsc_produce_slot(&RING)) != SPSC_FULL) {
+            atomic_store(&ROOM_WANTED, false);
+            break;
+        }
+        struct pollfd pfd = {.fd = ROOM_FD, .events = POLLIN};
+        if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+            err_exit("Failed on poll");
+        uint64_t count;
+        if (read(ROOM_FD, &count, sizeof(count)) == -1 && errno != EAGAIN)
+            err_exit("Failed on read eventfd");
+    }
+    return &RING_BATCH[slot];
+}
+
+static void batch_submit(struct batch *b) {
+    if (!THREADED) {
+        process_batch(b);
+        return;
+    }
+    spsc_produce(&RING);
+    WAKE_PENDING = true;
+}
+
+static void submit_device_change(int idx, enum batch_kind kind) {
+    struct batch *b = batch_begin();
+    b->kind         = kind;
+    b->device       = idx;
+    b->is_evdev     = DEVICES[idx].is_evdev;
+    b->count        = 0;
+    batch_submit(b);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// DEVICE UTILS (input side)
+////////////////////////////////////////////////////////////////////////////////
+static bool is_device_open(dev_t rdev) {
+    int i;
+    for (i = 0; i < MAX_DEVICES; i++)
+        if (DEVICES[i].fd != -1 && DEVICES[i].is_evdev &&
+            DEVICES[i].rdev == rdev)
+            return true;
+    return false;
+}
+
+static int free_device_slot(const char *path) {
+    int i;
+    for (i = 0; i < MAX_DEVICES && DEVICES[i].fd != -1; i++)
+        ;
+    if (i == MAX_DEVICES)
+        fprintf(stderr, "Too many devices, ignoring %s\n", path);
+    return i;
+}
+
+static void open_device(int idx, int fd, dev_t rdev, bool is_evdev) {
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = idx};
+    if (epoll_ctl(INPUT_EPOLL_FD, EPOLL_CTL_ADD, fd, &ev) == -1)
+        err_exit("Failed on epoll_ctl");
+    DEVICES[idx].fd       = fd;
+    DEVICES[idx].rdev     = rdev;
+    DEVICES[idx].is_evdev    = is_evdev;
+    DEVICES[idx].num_partial = 0;
+    submit_device_change(idx, BATCH_ADDED);
+}
+
+// Stdin is read like a device, e.g. `intercept -g ... | simul_daemon -`
+static void add_stdin(void) {
+    if (STDIN_USED)
+        return;
+    int i = free_device_slot(STDIN_PATTERN);
+    if (i == MAX_DEVICES)
+        return;
+    int flags = fcntl(STDIN_FILENO, F_GETFL);
+    if (flags == -1 || fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK) == -1)
+        err_exit("Failed on fcntl");
+    STDIN_USED = true;
+    open_device(i, STDIN_FILENO, 0, false);
+}
+
+static void add_device(const char *path) {
+    struct stat st;
+    if (stat(path, &st) == -1 || !S_ISCHR(st.st_mode) ||
+        is_device_open(st.st_rdev))
+        return;
+    int i = free_device_slot(path);
+    if (i == MAX_DEVICES)
+        return;
+
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        perror(path);
+        return;
+    }
+    // Event timestamps on the same clock as our timerfd, so the kernel
+    // time of an event can be used directly as 'now'
+    int clock_id = CLOCK_MONOTONIC;
+    if (ioctl(fd, EVIOCSCLOCKID, &clock_id) == -1 ||
+        ioctl(fd, EVIOCGRAB, 1) == -1) {
+        perror(path);
+        close(fd);
+        return;
+    }
+    open_device(i, fd, st.st_rdev, true);
+    fprintf(stderr, "Grabbed %s\n", path);
+}
+
+static void remove_device(int idx) {
+    close(DEVICES[idx].fd);  // Also removes it from the epoll set
+    DEVICES[idx].fd = -1;
+    submit_device_change(idx, BATCH_REMOVED);
+}
+
+static void scan_devices(void) {
+    int p;
+    for (p = 0; p < NUM_PATTERNS; p++) {
+        if (!strcmp(PATTERNS[p], STDIN_PATTERN)) {
+            add_stdin();
+            continue;
+        }
+        glob_t g;
+        if (glob(PATTERNS[p], 0, NULL, &g) != 0)
+            continue;
+        size_t i;
+        for (i = 0; i < g.gl_pathc; i++)
+            add_device(g.gl_pathv[i]);
+        globfree(&g);
+    }
+}
+
+// Reads go straight into the batch (a ring slot with `-t`)
+static void handle_device(int idx) {
+    struct device *dev = &DEVICES[idx];
+    for (;;) {
+        struct batch *b = batch_begin();
+        char *buf       = (char *)b->events;
+        memcpy(buf, dev->partial, dev->num_partial);
+        ssize_t n = read(dev->fd, buf + dev->num_partial,
+                         sizeof(b->events) - dev->num_partial);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && errno == EAGAIN)
+            return;
+        if (n <= 0) {
+            remove_device(idx);
+            return;
+        }
+        const size_t total = dev->num_partial + n;
+        b->kind            = BATCH_EVENTS;
+        b->device          = idx;
+        b->is_evdev        = dev->is_evdev;
+        b->arrival         = now_ns();
+        b->count           = total / sizeof(struct input_event);
+        dev->num_partial   = total % sizeof(struct input_event);
+        memcpy(dev->partial, buf + total - dev->num_partial, dev->num_partial);
+        batch_submit(b);
+        if (b->count < READ_EVENTS)
+            return;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// HOTPLUG (input side)
+////////////////////////////////////////////////////////////////////////////////
+// Hash udev puts in the header of its messages to filter on (MurmurHash2)
+static uint32_t udev_hash(const char *str) {
+    const uint32_t m = 0x5bd1e995;
+    size_t len       = strlen(str);
+    uint32_t h       = len;
+    const unsigned char *data = (const unsigned char *)str;
+    for (; len >= 4; data += 4, len -= 4) {
+        uint32_t k;
+        memcpy(&k, data, 4);
+        k *= m;
+        k ^= k >> 24;
+        k *= m;
+        h = h * m ^ k;
+    }
+    switch (len) {
+        case 3:
+            h ^= data[2] << 16;
+            // fall through
+        case 2:
+            h ^= data[1] << 8;
+            // fall through
+        case 1:
+            h ^= data[0];
+            h *= m;
+    }
+    h ^= h >> 13;
+    h *= m;
+    h ^= h >> 15;
+    return h;
+}
+
+// Only lets through what `handle_uevent` acts on, so e.g. a laptop's battery
+// updates never wake us up: kernel messages start with 'ACTION@DEVPATH',
+// only 'add@' passes; udev messages start with a "libudev" header holding
+// the (big endian) hash of the subsystem at offset 24, only "input" passes
+static int uevent_filter(int fd) {
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x61646440 /* "add@" */, 4, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x6c696275 /* "libu" */, 0, 2),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 24),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, udev_hash("input"), 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+    };
+    struct sock_fprog prog = {.len    = sizeof(code) / sizeof(code[0]),
+                              .filter = code};
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+static int uevent_open(void) {
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    NETLINK_KOBJECT_UEVENT);
+    // Group 1: raw kernel events, group 2: events re-broadcast by udev after
+    // it created the /dev/input/by-id links we usually match against
+    struct sockaddr_nl addr = {.nl_family = AF_NETLINK, .nl_groups = 1 | 2};
+    if (fd != -1 && uevent_filter(fd) == -1)
+        perror("Failed on uevent filter, waking up on every uevent");
+    if (fd == -1 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror("No hotplug support, failed on uevent socket");
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Messages are NUL separated 'KEY=value' strings (udev's have a binary
+// header in front, which never matches the keys we are looking for)
+static void handle_uevent(int fd) {
+    char buf[UEVENT_BUF_SIZE];
+    ssize_t len;
+    while ((len = recv(fd, buf, sizeof(buf) - 1, 0)) > 0) {
+        buf[len]         = '\0';
+        bool is_input    = false;
+        bool is_addition = false;
+        const char *s;
+        for (s = buf; s < buf + len; s += strlen(s) + 1) {
+            if (!strcmp(s, "SUBSYSTEM=input"))
+                is_input = true;
+            else if (!strcmp(s, "ACTION=add"))
+                is_addition = true;
+        }
+        // Removals are noticed by `read` failing on the device itself
+        if (is_input && is_addition)
+            scan_devices();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// LOOP
+////////////////////////////////////////////////////////////////////////////////
+static void epoll_add(int epoll_fd, int fd, uint32_t idx) {
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = idx};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        err_exit("Failed on epoll_ctl");
+}
+
+// Without `-t` a single loop gets every fd, with `-t` the input thread only
+// gets devices and hotplug, the decision thread only the timer and wakeups
+static void run_loop(int epoll_fd, int uevent_fd, bool is_decision) {
+    struct epoll_event ready[EPOLL_EVENTS];
+    for (;;) {
+        int n = epoll_wait(epoll_fd, ready, EPOLL_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            err_exit("Failed on epoll_wait");
+        }
+        if (n > 1 || (n == 1 && ready[0].data.u32 != EPOLL_IDX_SIGNAL))
+            atomic_fetch_add_explicit(&STATS.wakeups[is_decision], 1,
+                                      memory_order_relaxed);
+        int i;
+        for (i = 0; i < n; i++) {
+            uint32_t idx = ready[i].data.u32;
+            if (idx == EPOLL_IDX_TIMER)
+                handle_timer();
+            else if (idx == EPOLL_IDX_SIGNAL)
+                handle_signal();
+            else if (idx == EPOLL_IDX_OUTPUT)
+                handle_output();
+            else if (idx == EPOLL_IDX_WAKE)
+                handle_wake();
+            else if (idx == EPOLL_IDX_UEVENT)
+                handle_uevent(uevent_fd);
+            else if (DEVICES[idx].fd != -1)
+                handle_device(idx);
+        }
+        if (!is_decision && WAKE_PENDING)
+            wake_decision();
+        if (is_decision) {
+            if (MERGE)
+                merge_release(now_ns());
+            flush_out();
+            timer_update();
+        }
+    }
+}
+
+static void *input_thread(void *arg) {
+    (void)arg;
+    run_loop(INPUT_EPOLL_FD, UEVENT_FD, false);
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// MAIN
+////////////////////////////////////////////////////////////////////////////////
+static void source_keys_init(const struct chord_config *cfg) {
+    evbatch_keyset_clear(&BUILT_SOURCE_KEYS);
+    size_t r, s;
+    for (r = 0; r < cfg->num_rules; r++)
+        for (s = 0; s < cfg->rules[r].num_sources; s++)
+            evbatch_keyset_add(&BUILT_SOURCE_KEYS, cfg->rules[r].sources[s]);
+    SOURCE_KEYS = &BUILT_SOURCE_KEYS;
+}
+
+// Tables and source key set straight from the image, nothing to build
+static void keymap_init(const char *path) {
+#ifdef SIMUL_STATIC_RULES
+    fprintf(stderr, "%s: rules are compiled in (SIMUL_STATIC_RULES)\n", path);
+    exit(EXIT_FAILURE);
+#else
+    const struct keymap_image *img = keymap_map(path);
+    if (!img)
+        err_exit(path);
+    CONFIG      = &img->config;
+    SOURCE_KEYS = &img->sources;
+#endif
+}
+
+// Option in microseconds to ns, false unless it's a whole number that fits
+static bool parse_us(const char *arg, uint64_t *ns) {
+    char *end;
+    errno                       = 0;
+    const unsigned long long us = strtoull(arg, &end, 10);
+    if (!isdigit((unsigned char)arg[0]) || *end || errno ||
+        us > UINT64_MAX / 1000)
+        return false;
+    *ns = us * 1000;
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    const char *keymap_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "k:l:mp:tw:")) != -1) {
+        switch (opt) {
+            case 'k':
+                keymap_path = optarg;
+                break;
+            case 'l':
+                LATENCY = true;
+                if (!parse_us(optarg, &LAT_BUDGET_NS))
+                    optind = argc;  // Print usage
+                break;
+            case 'm':
+                MERGE = true;
+                break;
+            case 'p':
+                if (!strcmp(optarg, "keep"))
+                    DROP_NON_KEY = false;
+                else if (strcmp(optarg, "drop"))
+                    optind = argc;  // Print usage
+                break;
+            case 't':
+                THREADED = true;
+                break;
+            case 'w':
+                if (!parse_us(optarg, &MERGE_WINDOW_NS))
+                    optind = argc;  // Print usage
+                break;
+            default:
+                optind = argc;  // Print usage
+                break;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr,
+                "usage: %s [-k KEYMAP] [-l BUDGET_US] [-p drop|keep] [-t] "
+                "[-m [-w WINDOW_US]] DEVICE_PATH_OR_GLOB...\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    PATTERNS     = argv + optind;
+    NUM_PATTERNS = argc - optind;
+
+    if (keymap_path) {
+        keymap_init(keymap_path);
+    } else {
+#ifndef SIMUL_STATIC_RULES
+        chord_config_init(&BUILT_CONFIG);
+        CONFIG = &BUILT_CONFIG;
+#endif
+        source_keys_init(ENGINE_CONFIG);
+    }
+    chord_state_init(&MERGED_CHORD);
+    spsc_init(&RING, RING_BATCHES);
+    int i;
+    for (i = 0; i < MAX_DEVICES; i++)
+        DEVICES[i].fd = -1;
+
+    INPUT_EPOLL_FD = epoll_create1(EPOLL_CLOEXEC);
+    if (INPUT_EPOLL_FD == -1)
+        err_exit("Failed on epoll_create1");
+    DECISION_EPOLL_FD = INPUT_EPOLL_FD;
+    if (THREADED) {
+        DECISION_EPOLL_FD = epoll_create1(EPOLL_CLOEXEC);
+        WAKE_FD           = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        ROOM_FD           = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (DECISION_EPOLL_FD == -1 || WAKE_FD == -1 || ROOM_FD == -1)
+            err_exit("Failed on epoll_create1/eventfd");
+        epoll_add(DECISION_EPOLL_FD, WAKE_FD, EPOLL_IDX_WAKE);
+    }
+    int flags = fcntl(STDOUT_FILENO, F_GETFL);
+    if (flags == -1 || fcntl(STDOUT_FILENO, F_SETFL, flags | O_NONBLOCK) == -1)
+        err_exit("Failed on fcntl");
+    TIMER_FD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (TIMER_FD == -1)
+        err_exit("Failed on timerfd_create");
+    epoll_add(DECISION_EPOLL_FD, TIMER_FD, EPOLL_IDX_TIMER);
+    // Blocked before the input thread starts, so it inherits the mask and
+    // only the decision loop gets it, through the signalfd
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    if (pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0)
+        err_exit("Failed on pthread_sigmask");
+    SIGNAL_FD = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (SIGNAL_FD == -1)
+        err_exit("Failed on signalfd");
+    epoll_add(DECISION_EPOLL_FD, SIGNAL_FD, EPOLL_IDX_SIGNAL);
+    UEVENT_FD = uevent_open();
+    if (UEVENT_FD != -1)
+        epoll_add(INPUT_EPOLL_FD, UEVENT_FD, EPOLL_IDX_UEVENT);
+
+    scan_devices();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Run main loop(s)
+    ////////////////////////////////////////////////////////////////////////////
+    if (THREADED) {
+        // Devices added by the first scan are in the ring already
+        WAKE_PENDING = false;
+        handle_wake();
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, input_thread, NULL) != 0)
+            err_exit("Failed on pthread_create");
+    }
+    run_loop(DECISION_EPOLL_FD, UEVENT_FD, true);
+}
@@ -0,0 +1,127 @@
+#include <errno.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "simulkeys.h"
+
+// Goal of this program:
+// Same filter as `simul_three.c` (stdin to stdout, for an interception-tools
+// pipeline), but all chord logic comes from libsimulkeys (`simulkeys.h`).
+// What is left here is the I/O: one thread polls stdin and a timerfd armed at
+// the engine's next deadline, so there are no timer threads to race with.
+//
+// Rules come from `chord_rules.h`.
+
+////////////////////////////////////////////////////////////////////////////////
+// APPLICATION CONSTANTS
+////////////////////////////////////////////////////////////////////////////////
+#define err_exit(msg)       \
+    {                       \
+        perror(msg);        \
+        exit(EXIT_FAILURE); \
+    }
+#define READ_EVENTS 64
+
+static struct input_event OUT[SIMULKEYS_OUT_MAX(READ_EVENTS)];
+
+////////////////////////////////////////////////////////////////////////////////
+// UTILS
+////////////////////////////////////////////////////////////////////////////////
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void write_events(const struct input_event *events, size_t count) {
+    const char *buf = (const char *)events;
+    size_t left     = count * sizeof(struct input_event);
+    while (left) {
+        ssize_t n = write(STDOUT_FILENO, buf, left);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            err_exit("Failed on write");
+        }
+        buf += n;
+        left -= n;
+    }
+}
+
+static void timer_update(int timer_fd, uint64_t deadline) {
+    // All zero disarms the timer
+    struct itimerspec its = {0};
+    if (deadline != CHORD_NO_DEADLINE) {
+        its.it_value.tv_sec  = deadline / 1000000000;
+        its.it_value.tv_nsec = deadline % 1000000000;
+    }
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+        err_exit("Failed on timerfd_settime");
+}
+
+int main(void) {
+    struct simulkeys *sk = simulkeys_new(NULL, 0, 0);
+    if (!sk)
+        err_exit("Failed on simulkeys_new");
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (timer_fd == -1)
+        err_exit("Failed on timerfd_create");
+
+    struct input_event events[READ_EVENTS];
+    size_t buffered = 0;
+    struct pollfd fds[] = {{.fd = STDIN_FILENO, .events = POLLIN},
+                           {.fd = timer_fd, .events = POLLIN}};
+    uint64_t armed = CHORD_NO_DEADLINE;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Run main loop, reading events from stdin
+    ////////////////////////////////////////////////////////////////////////////
+    while (1) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            err_exit("Failed on poll");
+        }
+        if (fds[1].revents & POLLIN) {
+            uint64_t expirations;
+            if (read(timer_fd, &expirations, sizeof(expirations)) == -1 &&
+                errno != EAGAIN)
+                err_exit("Failed on read");
+            armed = CHORD_NO_DEADLINE;  // One shot, disarmed once it fired
+            write_events(OUT, simulkeys_on_deadline(sk, now_ns(), OUT));
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            ssize_t n = read(STDIN_FILENO, (char *)events + buffered,
+                             sizeof(events) - buffered);
+            if (n == -1 && errno != EINTR)
+                err_exit("Failed on read");
+            if (n == 0)
+                break;
+            if (n > 0) {
+                buffered += n;
+                size_t count = buffered / sizeof(struct input_event);
+                write_events(OUT,
+                             simulkeys_feed(sk, events, count, now_ns(), OUT));
+                // Keep a partially read event for the next read
+                buffered -= count * sizeof(struct input_event);
+                memmove(events, events + count, buffered);
+            }
+        }
+        const uint64_t deadline = simulkeys_next_deadline(sk);
+        if (deadline != armed) {
+            timer_update(timer_fd, deadline);
+            armed = deadline;
+        }
+    }
+    // Stdin closed, nothing more can complete a chord
+    write_events(OUT, simulkeys_on_deadline(sk, CHORD_NO_DEADLINE, OUT));
+    write_events(OUT, simulkeys_reset(sk, OUT));
+    simulkeys_free(sk);
+}
@@ -0,0 +1,136 @@
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chord.h"
+#include "keymap.h"
+
+// Goal of this program:
+// Compile chord rules into a keymap image (`keymap.h`) that `simul_daemon -k`
+// maps at start up, so changing rules needs no rebuild and starting the
+// daemon builds no tables. Rules are given as key codes (see
+// `linux/input-event-codes.h`), sources joined by '+':
+//
+//     simul_keymap -t 50 keymap.bin 36+37=1    # J+K -> ESC
+//
+// Without rules the ones of `chord_rules.h` are used. `-p` prints an
+// existing image instead.
+
+////////////////////////////////////////////////////////////////////////////////
+// APPLICATION CONSTANTS
+////////////////////////////////////////////////////////////////////////////////
+#define err_exit(msg)       \
+    {                       \
+        perror(msg);        \
+        exit(EXIT_FAILURE); \
+    }
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-t THRESHOLD_MS] OUT_FILE [SOURCE+SOURCE...=TARGET...]\n"
+            "       %s -p KEYMAP_FILE\n",
+            name, name);
+    exit(EXIT_FAILURE);
+}
+
+// 'SOURCE+SOURCE...=TARGET', -1 if malformed
+static int parse_rule(const char *s, struct chord_rule *rule) {
+    char *end;
+    memset(rule, 0, sizeof(*rule));
+    for (;;) {
+        if (rule->num_sources == CHORD_MAX_SOURCES)
+            return -1;
+        const unsigned long code = strtoul(s, &end, 10);
+        if (end == s || code >= KEY_CNT)
+            return -1;
+        rule->sources[rule->num_sources++] = code;
+        if (*end == '=')
+            break;
+        if (*end != '+')
+            return -1;
+        s = end + 1;
+    }
+    s                        = end + 1;
+    const unsigned long code = strtoul(s, &end, 10);
+    if (end == s || *end || code >= KEY_CNT)
+        return -1;
+    rule->target = code;
+    return 0;
+}
+
+static void print_image(const struct keymap_image *img) {
+    const struct chord_config *cfg = &img->config;
+    printf("keymap v%u, %u bytes, threshold %.1fms, %u rules\n",
+           img->header.version, img->header.image_size,
+           cfg->threshold_ns / 1e6, cfg->num_rules);
+    size_t r, s;
+    for (r = 0; r < cfg->num_rules; r++) {
+        printf("rule %zu: ", r);
+        for (s = 0; s < cfg->rules[r].num_sources; s++)
+            printf("%s%u", s ? "+" : "", cfg->rules[r].sources[s]);
+        printf(" -> %u\n", cfg->rules[r].target);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    double threshold_ms = 0;
+    bool print          = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "pt:")) != -1) {
+        switch (opt) {
+            case 'p':
+                print = true;
+                break;
+            case 't':
+                threshold_ms = strtod(optarg, NULL);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind >= argc || (print && optind != argc - 1))
+        usage(argv[0]);
+
+    if (print) {
+        const struct keymap_image *img = keymap_map(argv[optind]);
+        if (!img)
+            err_exit("Failed on keymap_map");
+        print_image(img);
+        keymap_unmap(img);
+        return EXIT_SUCCESS;
+    }
+
+    const char *path = argv[optind++];
+    struct chord_config cfg;
+    struct chord_rule rules[CHORD_MAX_RULES];
+    size_t num_rules = argc - optind, r;
+    chord_config_init(&cfg);
+    if (!num_rules) {
+        num_rules = cfg.num_rules;
+        memcpy(rules, cfg.rules, sizeof(rules));
+    } else if (num_rules > CHORD_MAX_RULES) {
+        fprintf(stderr, "At most %d rules\n", CHORD_MAX_RULES);
+        return EXIT_FAILURE;
+    }
+    for (r = 0; optind + r < (size_t)argc; r++) {
+        if (parse_rule(argv[optind + r], &rules[r]) == -1) {
+            fprintf(stderr, "Invalid rule '%s'\n", argv[optind + r]);
+            usage(argv[0]);
+        }
+    }
+    if (chord_config_set(&cfg, rules, num_rules,
+                         threshold_ms > 0 ? threshold_ms * 1e6
+                                          : cfg.threshold_ns) == -1)
+        err_exit("Invalid rules (a key can only be a source of one rule)");
+    if (keymap_save(path, &cfg) == -1)
+        err_exit("Failed on keymap_save");
+
+    const struct keymap_image *img = keymap_map(path);
+    if (!img)
+        err_exit("Failed on keymap_map");
+    print_image(img);
+    keymap_unmap(img);
+}
@@ -1,11 +1,17 @@
+#include <errno.h>
 #include <linux/input.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "evbatch.h"
+
 // TODO Try:
 // #include <linux/input-event-codes.h>
 // static const key_code SOURCE_KEYS
@@ -33,6 +39,7 @@ static const int TARGET_KEYS[] = {KEY_ESC};
 #define KEY_PRESSED 1
 #define KEY_REPEATED 2
 #define A_NON_SOURCE_KEY -1
+#define READ_EVENTS 64
 
 static const struct input_event SYN_EVENT = {
     .type = EV_SYN, .code = SYN_REPORT, .value = 0};
@@ -52,9 +59,37 @@ static const struct itimerspec ITS_OFF = {
     .it_interval.tv_nsec = 0,  // no repeat
 };
 
-static const size_t NUM_SOURCE_KEYS = sizeof(SOURCE_KEYS) / sizeof(int);
+#define NUM_SOURCE_KEYS_CONST (sizeof(SOURCE_KEYS) / sizeof(SOURCE_KEYS[0]))
+static const size_t NUM_SOURCE_KEYS = NUM_SOURCE_KEYS_CONST;
 static const size_t NUM_TARGET_KEYS = 1;
 
+// Where the press of a source key stands in the output. Timer threads and
+// the main thread both move it on, always with OUTPUT_LOCK held, so exactly
+// one of them gets to write a swallowed press.
+enum PressState {
+    PRESS_IDLE,     // Key up, or its press was consumed by a chord
+    PRESS_PENDING,  // Press swallowed, timer armed
+    PRESS_FLUSHED,  // Press written (threshold passed or flushed early)
+};
+
+// Everything a source key's timer needs, one per source key. The pool is
+// static so the pointer handed to the timer thread (`sival_ptr`) stays valid
+// for as long as the process runs, and nothing is allocated after start up.
+struct timer_context {
+    timer_t timer_id;
+    struct input_event press_event;  // Swallowed press, written on expiry
+    // Guarded by OUTPUT_LOCK
+    enum PressState state;
+    uint64_t deadline;  // Of the pending press: a handler that runs earlier
+                        // was queued for a previous press and is stale
+};
+static struct timer_context TIMER_CONTEXTS[NUM_SOURCE_KEYS_CONST];
+
+// The single sequenced writer: every output frame is committed under this
+// lock in one `write`, so frames of the main thread and of timer threads
+// never interleave and come out in the order their state changes were made.
+static pthread_mutex_t OUTPUT_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
 enum TargetState {
     TGT_INIT,
     TGT_PRESSED_WRITTEN,
@@ -64,26 +99,48 @@ enum TargetState {
 ////////////////////////////////////////////////////////////////////////////////
 // INPUT EVENT UTILS
 ////////////////////////////////////////////////////////////////////////////////
-void write_event(const struct input_event *event) {
-    if (fwrite(event, sizeof(struct input_event), 1, stdout) != 1)
-        err_exit("Failed on write_event");
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void output_lock(void) {
+    if (pthread_mutex_lock(&OUTPUT_LOCK) != 0)
+        err_exit("Failed on pthread_mutex_lock");
 }
 
-void write_input_event(const struct input_event *iep, bool syn_sleep) {
-    write_event(iep);
-    write_event(&SYN_EVENT);
-    // If we write another event after `iep` we need to sleep first
-    // for syncing of events to work (I think?)
-    // XXX we might be able to get rid of this?
-    //      sleep not responsibility of write key event?
-    if (syn_sleep)
-        usleep(20000);  // 0.2 ms or 200 us
+static inline void output_unlock(void) {
+    if (pthread_mutex_unlock(&OUTPUT_LOCK) != 0)
+        err_exit("Failed on pthread_mutex_unlock");
 }
 
-void write_key_event(const int key_code, char direction, bool syn_sleep) {
+// With OUTPUT_LOCK held
+void write_events(const struct input_event *events, size_t count) {
+    const char *buf = (const char *)events;
+    size_t left     = count * sizeof(struct input_event);
+    while (left) {
+        ssize_t n = write(STDOUT_FILENO, buf, left);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            err_exit("Failed on write_events");
+        }
+        buf += n;
+        left -= n;
+    }
+}
+
+// Event and SYN in one go, with OUTPUT_LOCK held
+void write_input_event(const struct input_event *iep) {
+    const struct input_event frame[] = {*iep, SYN_EVENT};
+    write_events(frame, 2);
+}
+
+void write_key_event(const int key_code, char direction) {
     const struct input_event ie = {
         .type = EV_KEY, .code = key_code, .value = direction};
-    write_input_event(&ie, syn_sleep);
+    write_input_event(&ie);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -101,14 +158,6 @@ void timer_arm(timer_t tid) {
         err_exit("Failed on timer_settime");
 }
 
-int is_timer_armed(timer_t tid) {
-    // Get timer status (remaining time)
-    struct itimerspec curr_its;
-    if (timer_gettime(tid, &curr_its) == -1)
-        err_exit("Failed on timer_gettime");
-    return (curr_its.it_value.tv_sec != 0 || curr_its.it_value.tv_nsec != 0);
-}
-
 long get_timer_time_left(timer_t tid) {
     struct itimerspec curr_its;
     if (timer_gettime(tid, &curr_its) == -1)
@@ -116,59 +165,79 @@ long get_timer_time_left(timer_t tid) {
     return (curr_its.it_value.tv_sec * 1e9) + curr_its.it_value.tv_nsec;
 }
 
-void timer_set_up(timer_t *tidp, void (*handler)(union sigval)) {
-    union sigval sv;
-    struct sigevent sev = {
-        .sigev_notify          = SIGEV_THREAD,
-        .sigev_value           = sv,
-        .sigev_notify_function = handler,
-    };
-    if (timer_create(CLOCK_REALTIME, &sev, tidp) != 0)
-        err_exit("Failed on timer_create");
+void timer_handler(union sigval sv) {
+    struct timer_context *ctx = sv.sival_ptr;
+    output_lock();
+    // The main thread may have flushed, released or chorded the key while
+    // this handler was on its way
+    if (ctx->state == PRESS_PENDING && now_ns() >= ctx->deadline) {
+        write_input_event(&ctx->press_event);
+        ctx->state = PRESS_FLUSHED;
+    }
+    output_unlock();
 }
 
-void timer_handler(union sigval sv) { write_input_event(sv.sival_ptr, true); }
-
-static inline void setup_timers(timer_t timer_ids[NUM_SOURCE_KEYS]) {
+// Monotonic clock: a wall clock change must not mistime the threshold
+static inline void setup_timers(void) {
     int j;
     for (j = 0; j < NUM_SOURCE_KEYS; j++) {
-        timer_t timerid;
-        timer_ids[j]              = timerid;
-        struct input_event src_ke = {
+        struct timer_context *ctx = &TIMER_CONTEXTS[j];
+        ctx->press_event          = (struct input_event){
             .type = EV_KEY, .code = SOURCE_KEYS[j], .value = KEY_PRESSED};
+        ctx->state                = PRESS_IDLE;
         struct sigevent sev = {
             .sigev_notify          = SIGEV_THREAD,
-            .sigev_value           = {.sival_ptr = &src_ke},
+            .sigev_value           = {.sival_ptr = ctx},
             .sigev_notify_function = &timer_handler,
         };
-        if (timer_create(CLOCK_REALTIME, &sev, &timerid) != 0)
+        if (timer_create(CLOCK_MONOTONIC, &sev, &ctx->timer_id) != 0)
             err_exit("Failed on timer_create");
     }
 }
 
-static inline bool are_all_other_timers_armed(size_t exclude_idx,
-                                              timer_t *timer_ids) {
-    bool all_other_timers_armed = false;
+static inline timer_t timer_of(size_t source_key_idx) {
+    return TIMER_CONTEXTS[source_key_idx].timer_id;
+}
+
+// The helpers below all run with OUTPUT_LOCK held
+
+static inline void swallow_source_key(size_t source_key_idx) {
+    struct timer_context *ctx = &TIMER_CONTEXTS[source_key_idx];
+    ctx->deadline             = now_ns() + SIMUL_THRESHOLD;
+    ctx->state                = PRESS_PENDING;
+    timer_arm(ctx->timer_id);
+}
+
+// Writes the swallowed press of a source key right away instead of on expiry
+static inline void flush_source_key(size_t source_key_idx) {
+    timer_disarm(timer_of(source_key_idx));
+    write_key_event(SOURCE_KEYS[source_key_idx], KEY_PRESSED);
+    TIMER_CONTEXTS[source_key_idx].state = PRESS_FLUSHED;
+}
+
+static inline bool are_all_other_presses_pending(size_t exclude_idx) {
+    bool all_other_pending = false;
     int i;
     for (i = 0; i < NUM_SOURCE_KEYS; i++) {
         if (i == exclude_idx)
             continue;
-        if (!is_timer_armed(timer_ids[i])) {
-            all_other_timers_armed = false;
+        if (TIMER_CONTEXTS[i].state != PRESS_PENDING) {
+            all_other_pending = false;
             break;
         }
-        all_other_timers_armed = true;
+        all_other_pending = true;
     }
-    return all_other_timers_armed;
+    return all_other_pending;
 }
 
-static inline void disarm_all_other_timers(size_t exclude_idx,
-                                           timer_t *timer_ids) {
+// The other source presses became the chord, none of them gets written
+static inline void consume_all_other_presses(size_t exclude_idx) {
     int i;
     for (i = 0; i < NUM_SOURCE_KEYS; i++) {
         if (i == exclude_idx)
             continue;
-        timer_disarm(timer_ids[i]);
+        timer_disarm(timer_of(i));
+        TIMER_CONTEXTS[i].state = PRESS_IDLE;
     }
 }
 
@@ -208,53 +277,55 @@ static inline void update_timer_order(char *timer_order, size_t src_key_idx) {
 // EVENT HANDLERS
 ////////////////////////////////////////////////////////////////////////////////
 static inline void handle_non_source_key_event(const struct input_event *event,
-                                               char *timer_order,
-                                               timer_t *timer_ids) {
+                                               char *timer_order) {
     if (event->value == KEY_PRESSED) {
-        // If any src key timer armed, disarm it and write appropriate event
+        // If any src key press is pending, write it first
         int i;
         for (i = NUM_SOURCE_KEYS - 1; i > -1; i--) {
             // Make sure oldest activated timer gets checked first:
             char timer_idx = timer_order[i];
-            if (is_timer_armed(timer_ids[timer_idx])) {
-                timer_disarm(timer_ids[timer_idx]);
-                write_key_event(SOURCE_KEYS[timer_idx], KEY_PRESSED, true);
-            }
+            if (TIMER_CONTEXTS[(size_t)timer_idx].state == PRESS_PENDING)
+                flush_source_key(timer_idx);
         }
     }
-    fwrite(event, sizeof(*event), 1, stdout);
+    write_events(event, 1);
 }
 
 static inline void handle_source_key_event(const struct input_event *event,
                                            size_t source_key_idx,
-                                           char *timer_order,
-                                           timer_t *timer_ids) {
+                                           char *timer_order) {
+    struct timer_context *ctx = &TIMER_CONTEXTS[source_key_idx];
     switch (event->value) {
         case KEY_PRESSED:
-            if (are_all_other_timers_armed(source_key_idx, timer_ids)) {
-                // Disarm all other timers:
-                disarm_all_other_timers(source_key_idx, timer_ids);
+            if (are_all_other_presses_pending(source_key_idx)) {
+                consume_all_other_presses(source_key_idx);
                 // Write target 'pressed' event:
-                write_key_event(TARGET_KEYS[0], KEY_PRESSED, false);
+                write_key_event(TARGET_KEYS[0], KEY_PRESSED);
                 TARGETS_STATE = TGT_PRESSED_WRITTEN;
             } else {
-                timer_arm(timer_ids[source_key_idx]);
+                swallow_source_key(source_key_idx);
                 update_timer_order(timer_order, source_key_idx);
             }
             break;
         case KEY_RELEASED:
-            if (TARGETS_STATE == TGT_RELEASED_WRITTEN)
-                // Timer shouldn't be armed anymore so we don't check
+            // Press already written (threshold passed or flushed early),
+            // so the release has to be written as well
+            if (ctx->state == PRESS_FLUSHED) {
+                ctx->state = PRESS_IDLE;
+                write_events(event, 1);
+            } else if (TARGETS_STATE == TGT_RELEASED_WRITTEN)
+                // Press consumed by the chord, nothing pending anymore
                 TARGETS_STATE = TGT_INIT;
             else if (TARGETS_STATE == TGT_PRESSED_WRITTEN) {
-                write_key_event(TARGET_KEYS[0], KEY_RELEASED, false);
+                write_key_event(TARGET_KEYS[0], KEY_RELEASED);
                 TARGETS_STATE = TGT_RELEASED_WRITTEN;
             }
             // Source key released before threshold has been reached:
-            else if (is_timer_armed(timer_ids[source_key_idx])) {
-                timer_disarm(timer_ids[source_key_idx]);
-                write_key_event(SOURCE_KEYS[source_key_idx], KEY_PRESSED, true);
-                fwrite(event, sizeof(*event), 1, stdout);
+            else if (ctx->state == PRESS_PENDING) {
+                timer_disarm(ctx->timer_id);
+                ctx->state = PRESS_IDLE;
+                write_key_event(SOURCE_KEYS[source_key_idx], KEY_PRESSED);
+                write_events(event, 1);
             }
             break;
         default:
@@ -270,13 +341,16 @@ int main(void) {
     // real-time without delays (I guess we could set the buffer to be smaller
     // then `struct input_event`, which would force it to be flushed as well?)
     setbuf(stdin, NULL), setbuf(stdout, NULL);
-    struct input_event event;
+    // Events are read in batches with `read` (an unbuffered `fread` would
+    // block until the whole batch is there)
+    struct input_event events[READ_EVENTS];
+    size_t buffered = 0;
+    ssize_t n;
 
     ////////////////////////////////////////////////////////////////////////////
     // Set up timers
     ////////////////////////////////////////////////////////////////////////////
-    timer_t timer_ids[NUM_SOURCE_KEYS];
-    setup_timers(timer_ids);
+    setup_timers();
 
     // Feels a bit jank, but need to keep track of order of timer activation
     char timer_order[NUM_SOURCE_KEYS];
@@ -287,25 +361,44 @@ int main(void) {
     ////////////////////////////////////////////////////////////////////////////
     // Run main loop, reading events from stdin
     ////////////////////////////////////////////////////////////////////////////
-    while (fread(&event, sizeof(event), 1, stdin) == 1) {
-        if (event.type != EV_KEY)
-            fwrite(&event, sizeof(event), 1, stdout);
-
-        // Find source key index in SOURCE_KEYS
-        size_t source_key_idx = find_source_key_index(event.code);
-
-        switch (source_key_idx) {
-            case A_NON_SOURCE_KEY:
-                handle_non_source_key_event(&event, timer_order, timer_ids);
-                break;
-            case 0:
-            case 1:
-            case 2:
-                handle_source_key_event(&event, source_key_idx, timer_order,
-                                        timer_ids);
-                break;
-            default:
-                break;
+    while ((n = read(STDIN_FILENO, (char *)events + buffered,
+                     sizeof(events) - buffered)) > 0) {
+        buffered += n;
+        size_t count = buffered / sizeof(struct input_event);
+        size_t i     = 0;
+        while (i < count) {
+            // Non-key events (SYN, MSC, pointer motion, ...) are written
+            // straight from the read buffer, a whole run at a time
+            size_t run = evbatch_skip_non_key(events + i, count - i);
+            output_lock();
+            if (run) {
+                write_events(events + i, run);
+                output_unlock();
+                i += run;
+                continue;
+            }
+
+            // Find source key index in SOURCE_KEYS
+            const struct input_event *event = &events[i++];
+            size_t source_key_idx = find_source_key_index(event->code);
+
+            switch (source_key_idx) {
+                case A_NON_SOURCE_KEY:
+                    handle_non_source_key_event(event, timer_order);
+                    break;
+                case 0:
+                case 1:
+                case 2:
+                    handle_source_key_event(event, source_key_idx,
+                                            timer_order);
+                    break;
+                default:
+                    break;
+            }
+            output_unlock();
         }
+        // Keep a partially read event for the next read
+        buffered -= count * sizeof(struct input_event);
+        memmove(events, events + count, buffered);
     }
 }
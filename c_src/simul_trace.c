@@ -0,0 +1,520 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chord.h"
+#include "steal.h"
+#include "trace.h"
+
+// Goal of this program:
+// Replay a recorded trace (binary `input_event` dump or `evtest` capture)
+// through the chord engine offline, on the trace's own clock, and report per
+// rule how often the chord was attempted, fired, fired by accident and how
+// much delay it added to normal typing. With `-o` the transformed stream is
+// written as well (binary, `-` for stdout), i.e. what the live filter would
+// have written. `-t` overrides the threshold of `chord_rules.h`.
+//
+// With `-g` a whole grid of thresholds is evaluated in one run instead, one
+// engine instance per threshold spread over `-j` threads (all cores by
+// default), giving hit rate, accidental chords and added delay for each:
+// what to set SIMUL_THRESHOLD to without retyping anything.
+//
+// Given a directory instead of a file (traces gathered from a whole fleet of
+// workstations), every trace file in it is replayed by its own engine
+// instance on a work-stealing pool of `-j` threads, and the per rule stats
+// and delay histograms are merged at the end. `-f csv|json` exports the per
+// file and merged results for dashboards instead of the text report.
+
+////////////////////////////////////////////////////////////////////////////////
+// APPLICATION CONSTANTS
+////////////////////////////////////////////////////////////////////////////////
+#define err_exit(msg)       \
+    {                       \
+        perror(msg);        \
+        exit(EXIT_FAILURE); \
+    }
+
+#define MAX_GRID 1024
+#define CACHE_LINE 64
+
+enum report_format { REPORT_TEXT, REPORT_CSV, REPORT_JSON };
+
+static struct chord_config CONFIG;
+static struct trace_run RUN;
+static enum report_format FORMAT = REPORT_TEXT;
+// Threshold grid (`-g`), one engine instance per threshold
+static struct chord_config *GRID_CONFIGS;
+static struct trace_run *GRID_RUNS;
+static size_t NUM_GRID;
+
+struct worker {
+    pthread_t tid;
+    const char *path;
+    struct trace_run **runs;
+    size_t num_runs;
+};
+
+// Fleet (directory) mode
+struct fleet_file {
+    char *path;
+    off_t size;
+    int error;     // errno if the trace couldn't be opened
+    char *report;  // Formatted per file report
+};
+
+struct fleet_worker {
+    _Alignas(CACHE_LINE) struct steal_deque deque;
+    pthread_t tid;
+    atomic_size_t *slots;
+    struct trace_run *run;
+    struct trace_stats total;  // Merged over the files this worker replayed
+};
+
+static struct fleet_file *FILES;
+static size_t NUM_FILES;
+static struct fleet_worker *WORKERS;
+static size_t NUM_WORKERS;
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-t THRESHOLD_MS] [-f text|csv|json] [-o OUT_FILE] "
+            "TRACE_FILE\n"
+            "       %s [-t THRESHOLD_MS] [-f text|csv|json] [-j THREADS] "
+            "TRACE_DIR\n"
+            "       %s -g MIN_MS:MAX_MS:STEP_MS [-j THREADS] TRACE_FILE\n",
+            name, name, name);
+    exit(EXIT_FAILURE);
+}
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void config_with_threshold(struct chord_config *cfg, double ms) {
+    struct chord_rule rules[CHORD_MAX_RULES];
+    chord_config_init(cfg);
+    memcpy(rules, cfg->rules, sizeof(rules));
+    if (chord_config_set(cfg, rules, cfg->num_rules, ms * 1e6) == -1)
+        err_exit("Failed on chord_config_set");
+}
+
+// Streams `path` once, every chunk goes through all of `runs` while it is
+// still in cache. -1 (errno set) if the trace can't be opened.
+static int replay(const char *path, struct trace_run **runs,
+                  size_t num_runs) {
+    struct trace *t = malloc(sizeof(struct trace));
+    if (!t)
+        err_exit("Failed on malloc");
+    if (trace_open(t, path) == -1) {
+        const int error = errno;
+        free(t);
+        errno = error;
+        return -1;
+    }
+    const struct input_event *events;
+    size_t count, r;
+    while ((events = trace_chunk(t, &count)))
+        for (r = 0; r < num_runs; r++)
+            trace_run_feed(runs[r], events, count);
+    for (r = 0; r < num_runs; r++)
+        trace_run_finish(runs[r]);
+    trace_close(t);
+    free(t);
+    return 0;
+}
+
+static void *worker(void *arg) {
+    struct worker *w = arg;
+    if (replay(w->path, w->runs, w->num_runs) == -1)
+        err_exit("Failed on trace_open");
+    return NULL;
+}
+
+static void report(FILE *f, const struct trace_stats *stats, const char *name,
+                   bool total) {
+    switch (FORMAT) {
+        case REPORT_TEXT:
+            if (name)
+                fprintf(f, "%s: ", name);
+            trace_stats_print(stats, &CONFIG, f);
+            break;
+        case REPORT_CSV:
+            trace_stats_csv(stats, &CONFIG, name, f);
+            break;
+        case REPORT_JSON:
+            trace_stats_json(stats, &CONFIG, name, total, f);
+            break;
+    }
+}
+
+// The whole export: per file reports, then the merged one. CSV rows of the
+// merged stats have `*` as file name. Files that couldn't be replayed are
+// left out (and out of the count) and listed on stderr. Returns the number
+// of files replayed.
+static size_t report_all(FILE *f, const struct trace_stats *total) {
+    size_t i, num_replayed = 0;
+    if (FORMAT == REPORT_CSV)
+        trace_stats_csv_header(f);
+    if (FORMAT == REPORT_JSON)
+        fputs("{\"files\": [\n", f);
+    for (i = 0; i < NUM_FILES; i++) {
+        if (FILES[i].error)
+            continue;
+        if (FORMAT == REPORT_JSON && num_replayed)
+            fputs(",\n", f);
+        fputs(FILES[i].report, f);
+        num_replayed++;
+    }
+    switch (FORMAT) {
+        case REPORT_TEXT:
+            fprintf(f, "\nall %zu files: ", num_replayed);
+            report(f, total, NULL, true);
+            break;
+        case REPORT_CSV:
+            report(f, total, "*", true);
+            break;
+        case REPORT_JSON:
+            fputs("\n], \"total\": ", f);
+            report(f, total, NULL, true);
+            fputs("}\n", f);
+            break;
+    }
+    if (num_replayed < NUM_FILES) {
+        fprintf(stderr, "%zu of %zu files failed:\n", NUM_FILES - num_replayed,
+                NUM_FILES);
+        for (i = 0; i < NUM_FILES; i++)
+            if (FILES[i].error)
+                fprintf(stderr, "  %s: %s\n", FILES[i].path,
+                        strerror(FILES[i].error));
+    }
+    return num_replayed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// THRESHOLD GRID
+////////////////////////////////////////////////////////////////////////////////
+// Thresholds are dealt out round-robin over the threads (so small and large
+// ones, which cost about the same, are spread evenly), every thread streams
+// the trace once for all of its engines; the file is only read from disk
+// once, the other threads get it from the page cache.
+static void run_grid(const char *path, double min_ms, double max_ms,
+                     double step_ms, size_t num_threads) {
+    double ms;
+    for (ms = min_ms; ms <= max_ms + 1e-9 && NUM_GRID < MAX_GRID;
+         ms += step_ms)
+        NUM_GRID++;
+    // Every threshold costs an engine and its stats, rather than cutting the
+    // grid short ask for a coarser one
+    if (ms <= max_ms + 1e-9) {
+        fprintf(stderr, "-g %g:%g:%g: more than %d thresholds, use a larger "
+                "step\n",
+                min_ms, max_ms, step_ms, MAX_GRID);
+        exit(EXIT_FAILURE);
+    }
+    GRID_CONFIGS = calloc(NUM_GRID, sizeof(struct chord_config));
+    GRID_RUNS    = calloc(NUM_GRID, sizeof(struct trace_run));
+    struct trace_run **runs = calloc(NUM_GRID, sizeof(struct trace_run *));
+    if (num_threads > NUM_GRID)
+        num_threads = NUM_GRID;
+    struct worker *workers = calloc(num_threads, sizeof(struct worker));
+    if (!GRID_CONFIGS || !GRID_RUNS || !runs || !workers)
+        err_exit("Failed on calloc");
+
+    size_t i, w, n = 0;
+    for (i = 0; i < NUM_GRID; i++) {
+        config_with_threshold(&GRID_CONFIGS[i], min_ms + i * step_ms);
+        trace_run_init(&GRID_RUNS[i], &GRID_CONFIGS[i], -1);
+    }
+    for (w = 0; w < num_threads; w++) {
+        workers[w].path = path;
+        workers[w].runs = runs + n;
+        for (i = w; i < NUM_GRID; i += num_threads)
+            runs[n++] = &GRID_RUNS[i];
+        workers[w].num_runs = runs + n - workers[w].runs;
+        if (pthread_create(&workers[w].tid, NULL, worker, &workers[w]) != 0)
+            err_exit("Failed on pthread_create");
+    }
+    for (w = 0; w < num_threads; w++)
+        pthread_join(workers[w].tid, NULL);
+
+    printf("threshold rule  attempts    chords  hit rate  accidental  "
+           "delay mean  delay p99\n");
+    for (i = 0; i < NUM_GRID; i++) {
+        const struct trace_stats *st = &GRID_RUNS[i].stats;
+        size_t r;
+        for (r = 0; r < st->num_rules; r++) {
+            const struct trace_rule_stats *rs = &st->rules[r];
+            printf("%7.1fms %4zu %9lu %9lu %8.1f%% %11lu %9.2fms %8.2fms\n",
+                   GRID_CONFIGS[i].threshold_ns / 1e6, r, rs->attempts,
+                   rs->chords,
+                   rs->attempts ? 100.0 * rs->chords / rs->attempts : 0.0,
+                   rs->accidental,
+                   rs->delay.count ? rs->delay.sum_ns / 1e6 / rs->delay.count
+                                   : 0.0,
+                   trace_hist_quantile(&rs->delay, 990) / 1e6);
+        }
+    }
+    free(workers);
+    free(runs);
+    free(GRID_RUNS);
+    free(GRID_CONFIGS);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// FLEET
+////////////////////////////////////////////////////////////////////////////////
+static int by_name(const void *a, const void *b) {
+    return strcmp(((const struct fleet_file *)a)->path,
+                  ((const struct fleet_file *)b)->path);
+}
+
+// Regular, non-hidden files of `dir`, sorted by name
+static void list_files(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d)
+        err_exit("Failed on opendir");
+    size_t capacity = 0;
+    struct dirent *ent;
+    while ((ent = readdir(d))) {
+        if (ent->d_name[0] == '.')
+            continue;
+        char *path;
+        struct stat st;
+        if (asprintf(&path, "%s/%s", dir, ent->d_name) == -1)
+            err_exit("Failed on asprintf");
+        if (stat(path, &st) == -1 || !S_ISREG(st.st_mode)) {
+            free(path);
+            continue;
+        }
+        if (NUM_FILES == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            FILES    = realloc(FILES, capacity * sizeof(struct fleet_file));
+            if (!FILES)
+                err_exit("Failed on realloc");
+        }
+        FILES[NUM_FILES++] = (struct fleet_file){.path = path,
+                                                 .size = st.st_size};
+    }
+    closedir(d);
+    qsort(FILES, NUM_FILES, sizeof(struct fleet_file), by_name);
+}
+
+static void fleet_replay(struct fleet_worker *w, struct fleet_file *file) {
+    size_t len;
+    trace_run_init(w->run, &CONFIG, -1);
+    if (replay(file->path, &w->run, 1) == -1) {
+        file->error = errno;
+        return;
+    }
+    trace_stats_merge(&w->total, &w->run->stats);
+    FILE *f = open_memstream(&file->report, &len);
+    if (!f)
+        err_exit("Failed on open_memstream");
+    report(f, &w->run->stats, file->path, false);
+    fclose(f);
+}
+
+// Own deque first (largest files first), then steal from the others
+// (smallest first), until every deque is empty. No new tasks show up while
+// running, so once all deques are seen empty the worker is done.
+static void *fleet_worker(void *arg) {
+    struct fleet_worker *w = arg;
+    const size_t self      = w - WORKERS;
+    while (1) {
+        size_t task = steal_take(&w->deque);
+        size_t v;
+        bool retry = true;
+        while (task == STEAL_EMPTY && retry) {
+            retry = false;
+            for (v = 1; v < NUM_WORKERS && task == STEAL_EMPTY; v++) {
+                task = steal(&WORKERS[(self + v) % NUM_WORKERS].deque);
+                if (task == STEAL_RETRY) {
+                    retry = true;
+                    task  = STEAL_EMPTY;
+                }
+            }
+        }
+        if (task == STEAL_EMPTY)
+            break;
+        fleet_replay(w, &FILES[task]);
+    }
+    return NULL;
+}
+
+static int by_size(const void *a, const void *b) {
+    const off_t sa = FILES[*(const size_t *)a].size;
+    const off_t sb = FILES[*(const size_t *)b].size;
+    return (sa > sb) - (sa < sb);
+}
+
+// Files are dealt out round-robin by size, so every worker starts with about
+// the same amount of work; whoever runs out early steals the rest.
+static void run_fleet(const char *dir, size_t num_threads) {
+    list_files(dir);
+    if (!NUM_FILES) {
+        fprintf(stderr, "%s: no trace files\n", dir);
+        exit(EXIT_FAILURE);
+    }
+    if (num_threads > NUM_FILES)
+        num_threads = NUM_FILES;
+    NUM_WORKERS = num_threads;
+    WORKERS     = aligned_alloc(CACHE_LINE,
+                                NUM_WORKERS * sizeof(struct fleet_worker));
+    size_t *order = calloc(NUM_FILES, sizeof(size_t));
+    if (!WORKERS || !order)
+        err_exit("Failed on alloc");
+    memset(WORKERS, 0, NUM_WORKERS * sizeof(struct fleet_worker));
+
+    size_t capacity = 1, i, w;
+    while (capacity < NUM_FILES / NUM_WORKERS + 1)
+        capacity *= 2;
+    for (i = 0; i < NUM_FILES; i++)
+        order[i] = i;
+    qsort(order, NUM_FILES, sizeof(size_t), by_size);
+    for (w = 0; w < NUM_WORKERS; w++) {
+        WORKERS[w].slots = calloc(capacity, sizeof(atomic_size_t));
+        WORKERS[w].run   = malloc(sizeof(struct trace_run));
+        if (!WORKERS[w].slots || !WORKERS[w].run)
+            err_exit("Failed on alloc");
+        steal_init(&WORKERS[w].deque, WORKERS[w].slots, capacity);
+        WORKERS[w].total.num_rules = CONFIG.num_rules;
+    }
+    // Smallest pushed first, so the owner takes its largest file first
+    for (i = 0; i < NUM_FILES; i++)
+        if (steal_push(&WORKERS[i % NUM_WORKERS].deque, order[i]) == -1)
+            err_exit("Failed on steal_push");
+
+    const uint64_t start = now_ns();
+    for (w = 0; w < NUM_WORKERS; w++)
+        if (pthread_create(&WORKERS[w].tid, NULL, fleet_worker,
+                           &WORKERS[w]) != 0)
+            err_exit("Failed on pthread_create");
+    for (w = 0; w < NUM_WORKERS; w++)
+        pthread_join(WORKERS[w].tid, NULL);
+    const uint64_t elapsed = now_ns() - start;
+
+    for (w = 1; w < NUM_WORKERS; w++)
+        trace_stats_merge(&WORKERS[0].total, &WORKERS[w].total);
+    const size_t num_replayed = report_all(stdout, &WORKERS[0].total);
+    fprintf(stderr, "%zu files, %lu events in %.2fs (%.1fM events/s), "
+            "%zu threads\n",
+            num_replayed, WORKERS[0].total.events_in, elapsed / 1e9,
+            WORKERS[0].total.events_in / (elapsed / 1e3), NUM_WORKERS);
+
+    for (w = 0; w < NUM_WORKERS; w++) {
+        free(WORKERS[w].slots);
+        free(WORKERS[w].run);
+    }
+    for (i = 0; i < NUM_FILES; i++) {
+        free(FILES[i].path);
+        free(FILES[i].report);
+    }
+    free(order);
+    free(WORKERS);
+    free(FILES);
+}
+
+int main(int argc, char *argv[]) {
+    const char *out_path = NULL;
+    double threshold_ms  = 0;
+    double grid[3]       = {0};
+    bool use_grid        = false;
+    long num_threads     = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while ((opt = getopt(argc, argv, "f:g:j:o:t:")) != -1) {
+        switch (opt) {
+            case 'f':
+                if (!strcmp(optarg, "csv"))
+                    FORMAT = REPORT_CSV;
+                else if (!strcmp(optarg, "json"))
+                    FORMAT = REPORT_JSON;
+                else if (strcmp(optarg, "text"))
+                    usage(argv[0]);
+                break;
+            case 'g':
+                use_grid = sscanf(optarg, "%lf:%lf:%lf", &grid[0], &grid[1],
+                                  &grid[2]) == 3 &&
+                           grid[0] > 0 && grid[2] > 0 && grid[1] >= grid[0];
+                if (!use_grid)
+                    usage(argv[0]);
+                break;
+            case 'j':
+                num_threads = strtol(optarg, NULL, 10);
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            case 't':
+                threshold_ms = strtod(optarg, NULL);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 ||
+        (use_grid && (out_path || threshold_ms > 0 || FORMAT != REPORT_TEXT)))
+        usage(argv[0]);
+    if (use_grid) {
+        run_grid(argv[optind], grid[0], grid[1], grid[2],
+                 num_threads > 0 ? num_threads : 1);
+        return EXIT_SUCCESS;
+    }
+
+    if (threshold_ms > 0)
+        config_with_threshold(&CONFIG, threshold_ms);
+    else
+        chord_config_init(&CONFIG);
+
+    struct stat st;
+    if (stat(argv[optind], &st) == 0 && S_ISDIR(st.st_mode)) {
+        if (out_path)
+            usage(argv[0]);
+        run_fleet(argv[optind], num_threads > 0 ? num_threads : 1);
+        return EXIT_SUCCESS;
+    }
+
+    int out_fd = -1;
+    if (out_path && !strcmp(out_path, "-"))
+        out_fd = STDOUT_FILENO;
+    else if (out_path &&
+             (out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                            0644)) == -1)
+        err_exit("Failed on open");
+
+    struct trace_run *run = &RUN;
+    trace_run_init(run, &CONFIG, out_fd);
+    if (replay(argv[optind], &run, 1) == -1)
+        err_exit("Failed on trace_open");
+
+    // Keep the stats out of the event stream
+    FILE *f = out_fd == STDOUT_FILENO ? stderr : stdout;
+    if (FORMAT == REPORT_TEXT) {
+        report(f, &RUN.stats, NULL, false);
+    } else {
+        struct fleet_file file = {.path = argv[optind]};
+        size_t len;
+        FILE *mem = open_memstream(&file.report, &len);
+        if (!mem)
+            err_exit("Failed on open_memstream");
+        report(mem, &RUN.stats, file.path, false);
+        fclose(mem);
+        FILES     = &file;
+        NUM_FILES = 1;
+        report_all(f, &RUN.stats);
+        free(file.report);
+    }
+    if (out_fd != -1 && out_fd != STDOUT_FILENO)
+        close(out_fd);
+}
@@ -0,0 +1,101 @@
+#include "simulkeys.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chord_impl.h"
+#include "chord_rules.h"
+#include "evbatch.h"
+
+struct simulkeys {
+    struct chord_config cfg;
+    struct chord_state st;
+    struct evbatch_keyset sources;
+};
+
+static const struct chord_rule DEFAULT_RULES[] = {SIMUL_RULES};
+
+////////////////////////////////////////////////////////////////////////////////
+// INIT
+////////////////////////////////////////////////////////////////////////////////
+size_t simulkeys_size(void) { return sizeof(struct simulkeys); }
+
+struct simulkeys *simulkeys_init(void *mem, const struct chord_rule *rules,
+                                 size_t num_rules, uint64_t threshold_ns) {
+    struct simulkeys *sk = mem;
+    if (!rules) {
+        rules     = DEFAULT_RULES;
+        num_rules = sizeof(DEFAULT_RULES) / sizeof(DEFAULT_RULES[0]);
+    }
+    if (chord_config_set(&sk->cfg, rules, num_rules,
+                         threshold_ns ? threshold_ns : SIMUL_THRESHOLD) == -1)
+        return NULL;
+    chord_state_init(&sk->st);
+    evbatch_keyset_clear(&sk->sources);
+    size_t r, s;
+    for (r = 0; r < num_rules; r++)
+        for (s = 0; s < rules[r].num_sources; s++)
+            evbatch_keyset_add(&sk->sources, rules[r].sources[s]);
+    return sk;
+}
+
+struct simulkeys *simulkeys_new(const struct chord_rule *rules,
+                                size_t num_rules, uint64_t threshold_ns) {
+    void *mem = malloc(sizeof(struct simulkeys));
+    if (!mem)
+        return NULL;
+    struct simulkeys *sk = simulkeys_init(mem, rules, num_rules, threshold_ns);
+    if (!sk)
+        free(mem);
+    return sk;
+}
+
+void simulkeys_free(struct simulkeys *sk) { free(sk); }
+
+////////////////////////////////////////////////////////////////////////////////
+// API
+////////////////////////////////////////////////////////////////////////////////
+size_t simulkeys_feed(struct simulkeys *sk, const struct input_event *events,
+                      size_t n, uint64_t now, struct input_event *out) {
+    size_t i = 0, count = 0;
+    // Presses held back past their deadline go first, as if the timer had
+    // fired before these events, not after the runs copied below
+    if (chord_next_deadline(&sk->st) <= now)
+        count = chord_impl_expire(&sk->st, now, out);
+    while (i < n) {
+        // Whole runs of non-key events skip the engine, and so do other keys
+        // while no source key press is held back
+        size_t run = sk->st.num_pending
+                         ? evbatch_skip_non_key(events + i, n - i)
+                         : evbatch_skip_non_source(events + i, n - i,
+                                                   &sk->sources);
+        if (run) {
+            memcpy(out + count, events + i, run * sizeof(events[0]));
+            count += run;
+            i += run;
+            continue;
+        }
+        count += chord_impl_feed(&sk->cfg, &sk->st, &events[i], now,
+                                 out + count);
+        i++;
+    }
+    return count;
+}
+
+uint64_t simulkeys_next_deadline(const struct simulkeys *sk) {
+    return chord_next_deadline(&sk->st);
+}
+
+size_t simulkeys_on_deadline(struct simulkeys *sk, uint64_t now,
+                             struct input_event *out) {
+    return chord_impl_expire(&sk->st, now, out);
+}
+
+size_t simulkeys_reset(struct simulkeys *sk, struct input_event *out) {
+    return chord_impl_reset(&sk->cfg, &sk->st, out);
+}
+
+bool simulkeys_is_source_key(const struct simulkeys *sk, uint16_t code) {
+    return chord_is_source_key(&sk->cfg, code);
+}
@@ -0,0 +1,61 @@
+#ifndef SIMULKEYS_H
+#define SIMULKEYS_H
+
+#include <linux/input.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chord.h"
+
+// libsimulkeys: the chord engine behind an opaque handle, for anything that
+// wants to embed it (filters, the Python binding, benchmarks, daemons).
+// No I/O, no clock reads and no allocation after `simulkeys_new` (or none at
+// all with `simulkeys_init` on caller memory). Timestamps are nanoseconds on
+// whatever clock the caller uses, the caller arms its own timer at
+// `simulkeys_next_deadline` and calls `simulkeys_on_deadline` when it fires.
+//
+// One handle is one input stream and is not thread safe.
+
+struct simulkeys;
+
+// Output buffer size (in events) that is always enough for `n` input events
+#define SIMULKEYS_OUT_MAX(n) (3 * (size_t)(n) + 2 * CHORD_MAX_PENDING)
+
+////////////////////////////////////////////////////////////////////////////////
+// INIT
+////////////////////////////////////////////////////////////////////////////////
+// `rules` NULL (and `num_rules` 0) selects the rule set of `chord_rules.h`,
+// `threshold_ns` 0 its threshold. NULL (errno EINVAL) on an invalid rule set,
+// see `chord_config_set`.
+size_t simulkeys_size(void);
+struct simulkeys *simulkeys_init(void *mem, const struct chord_rule *rules,
+                                 size_t num_rules, uint64_t threshold_ns);
+struct simulkeys *simulkeys_new(const struct chord_rule *rules,
+                                size_t num_rules, uint64_t threshold_ns);
+void simulkeys_free(struct simulkeys *sk);
+
+////////////////////////////////////////////////////////////////////////////////
+// API
+////////////////////////////////////////////////////////////////////////////////
+// All of these write to `out` and return the number of events written.
+// `out` must hold `SIMULKEYS_OUT_MAX(n)` events for `simulkeys_feed` and
+// `SIMULKEYS_OUT_MAX(0)` for the others.
+
+// `events` all arrived at `now`, non-key events are copied through as is
+size_t simulkeys_feed(struct simulkeys *sk, const struct input_event *events,
+                      size_t n, uint64_t now, struct input_event *out);
+
+// CHORD_NO_DEADLINE when nothing is held back
+uint64_t simulkeys_next_deadline(const struct simulkeys *sk);
+
+// Writes every held back press whose deadline is at or before `now`
+size_t simulkeys_on_deadline(struct simulkeys *sk, uint64_t now,
+                             struct input_event *out);
+
+// Input stream went away, releases targets that are still down
+size_t simulkeys_reset(struct simulkeys *sk, struct input_event *out);
+
+bool simulkeys_is_source_key(const struct simulkeys *sk, uint16_t code);
+
+#endif
@@ -0,0 +1,369 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "simulkeys.h"
+
+// CPython binding for libsimulkeys (`simulkeys.h`): whole `bytes` buffers of
+// `struct input_event`s go through the native engine in one call, so Python
+// is only left with configuration and I/O glue. See `py_src/native_simul.py`.
+//
+//     engine = simulkeys.Engine(rules=[((KEY_J, KEY_K), KEY_ESC)],
+//                               threshold=0.05)
+//     out = engine.feed(os.read(fd, n))      # bytes in, bytes out
+//     timeout = engine.timeout()             # seconds, None if nothing held
+//     out = engine.on_deadline()             # when `timeout` ran out
+//
+// Timestamps are CLOCK_MONOTONIC nanoseconds (`time.monotonic_ns()`), taken
+// on every call unless `now` is given.
+
+#define EVENT_SIZE sizeof(struct input_event)
+
+typedef struct {
+    PyObject_HEAD
+    struct simulkeys *sk;
+    // A read can end halfway through an event, that part is kept for the
+    // next `feed`
+    size_t num_partial;
+    _Alignas(struct input_event) char partial[EVENT_SIZE];
+} EngineObject;
+
+////////////////////////////////////////////////////////////////////////////////
+// UTILS
+////////////////////////////////////////////////////////////////////////////////
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int parse_now(PyObject *obj, uint64_t *now) {
+    if (obj == NULL || obj == Py_None) {
+        *now = now_ns();
+        return 0;
+    }
+    *now = PyLong_AsUnsignedLongLong(obj);
+    return PyErr_Occurred() ? -1 : 0;
+}
+
+// Output buffer for `max_events` events, shrunk to what was written by
+// `finish_output`
+static PyObject *new_output(size_t max_events, struct input_event **out) {
+    PyObject *bytes = PyBytes_FromStringAndSize(NULL, max_events * EVENT_SIZE);
+    if (bytes)
+        *out = (struct input_event *)PyBytes_AS_STRING(bytes);
+    return bytes;
+}
+
+static PyObject *finish_output(PyObject *bytes, size_t count) {
+    if (_PyBytes_Resize(&bytes, count * EVENT_SIZE) == -1)
+        return NULL;
+    return bytes;
+}
+
+// Key codes are `uint16_t` in the engine, anything out of range would be
+// truncated into some other key
+static int parse_key(PyObject *obj, uint16_t *code) {
+    const unsigned long value = PyLong_AsUnsignedLong(obj);
+    if (PyErr_Occurred()) {
+        if (!PyErr_ExceptionMatches(PyExc_OverflowError))
+            return -1;
+        PyErr_Clear();
+    } else if (value < KEY_CNT) {
+        *code = value;
+        return 0;
+    }
+    PyErr_Format(PyExc_ValueError, "key code %R out of range (0 to %d)", obj,
+                 KEY_CNT - 1);
+    return -1;
+}
+
+// `rules`: iterable of (sources, target), `sources` an iterable of key codes.
+// Checks everything `chord_config_set` does, so the error says what is wrong.
+static int parse_rules(PyObject *obj, struct chord_rule *rules,
+                       size_t *num_rules) {
+    PyObject *seq = PySequence_Fast(obj, "rules must be a sequence");
+    if (!seq)
+        return -1;
+    const Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    if (!n) {
+        PyErr_SetString(PyExc_ValueError,
+                        "no rules given (None for the ones of chord_rules.h)");
+        goto fail;
+    }
+    if (n > CHORD_MAX_RULES) {
+        PyErr_Format(PyExc_ValueError, "at most %d rules", CHORD_MAX_RULES);
+        goto fail;
+    }
+    Py_ssize_t r;
+    for (r = 0; r < n; r++) {
+        PyObject *sources, *target, *sources_seq;
+        if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(seq, r), "OO", &sources,
+                              &target) ||
+            parse_key(target, &rules[r].target) == -1)
+            goto fail;
+        sources_seq = PySequence_Fast(sources, "sources must be a sequence");
+        if (!sources_seq)
+            goto fail;
+        const Py_ssize_t num_sources = PySequence_Fast_GET_SIZE(sources_seq);
+        if (!num_sources || num_sources > CHORD_MAX_SOURCES) {
+            PyErr_Format(PyExc_ValueError, "rule %zd: 1 to %d sources", r,
+                         CHORD_MAX_SOURCES);
+            Py_DECREF(sources_seq);
+            goto fail;
+        }
+        Py_ssize_t s, other_r, other_s;
+        for (s = 0; s < num_sources; s++) {
+            uint16_t *code = &rules[r].sources[s];
+            if (parse_key(PySequence_Fast_GET_ITEM(sources_seq, s), code) ==
+                -1) {
+                Py_DECREF(sources_seq);
+                goto fail;
+            }
+            // A key can only be a source key of one rule
+            for (other_r = 0; other_r <= r; other_r++) {
+                const Py_ssize_t end =
+                    other_r == r ? s : rules[other_r].num_sources;
+                for (other_s = 0; other_s < end; other_s++) {
+                    if (rules[other_r].sources[other_s] == *code) {
+                        PyErr_Format(PyExc_ValueError,
+                                     "key %u is a source key more than once "
+                                     "(a key can only be a source of one "
+                                     "rule)",
+                                     *code);
+                        Py_DECREF(sources_seq);
+                        goto fail;
+                    }
+                }
+            }
+        }
+        Py_DECREF(sources_seq);
+        rules[r].num_sources = num_sources;
+    }
+    *num_rules = n;
+    Py_DECREF(seq);
+    return 0;
+fail:
+    Py_DECREF(seq);
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// ENGINE
+////////////////////////////////////////////////////////////////////////////////
+// No handle if `__init__` never ran (e.g. `Engine.__new__(Engine)`)
+static int check_engine(const EngineObject *self) {
+    if (self->sk)
+        return 0;
+    PyErr_SetString(PyExc_RuntimeError, "Engine is not initialized");
+    return -1;
+}
+
+static int Engine_init(EngineObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"rules", "threshold", NULL};
+    PyObject *rules_obj   = NULL;
+    double threshold      = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Od", kwlist, &rules_obj,
+                                     &threshold))
+        return -1;
+
+    // Converted to ns below, anything else would be undefined
+    if (!isfinite(threshold) || threshold < 0 ||
+        threshold >= UINT64_MAX / 1e9) {
+        PyErr_SetString(PyExc_ValueError,
+                        "threshold out of range (0 to 1.8e10 seconds)");
+        return -1;
+    }
+    struct chord_rule rules[CHORD_MAX_RULES] = {0};
+    size_t num_rules = 0;
+    if (rules_obj && rules_obj != Py_None &&
+        parse_rules(rules_obj, rules, &num_rules) == -1)
+        return -1;
+
+    // A failing `__init__` on a live engine leaves it as it was
+    struct simulkeys *sk = simulkeys_new(num_rules ? rules : NULL, num_rules,
+                                         (uint64_t)(threshold * 1e9));
+    if (!sk) {
+        if (errno == ENOMEM)
+            PyErr_NoMemory();
+        else
+            PyErr_SetFromErrno(PyExc_ValueError);
+        return -1;
+    }
+    simulkeys_free(self->sk);
+    self->sk          = sk;
+    self->num_partial = 0;
+    return 0;
+}
+
+static void Engine_dealloc(EngineObject *self) {
+    simulkeys_free(self->sk);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *Engine_feed(EngineObject *self, PyObject *args) {
+    Py_buffer in;
+    PyObject *now_obj = NULL;
+    uint64_t now;
+    if (check_engine(self) == -1 ||
+        !PyArg_ParseTuple(args, "y*|O", &in, &now_obj))
+        return NULL;
+    if (parse_now(now_obj, &now) == -1) {
+        PyBuffer_Release(&in);
+        return NULL;
+    }
+
+    const char *data = in.buf;
+    size_t len       = in.len;
+    const size_t max_events = (self->num_partial + len) / EVENT_SIZE;
+    struct input_event *out;
+    PyObject *bytes = new_output(SIMULKEYS_OUT_MAX(max_events), &out);
+    if (!bytes) {
+        PyBuffer_Release(&in);
+        return NULL;
+    }
+    size_t count = 0;
+    // Complete the event left over from the last call first
+    if (self->num_partial) {
+        size_t take = EVENT_SIZE - self->num_partial;
+        if (take > len)
+            take = len;
+        memcpy(self->partial + self->num_partial, data, take);
+        self->num_partial += take;
+        data += take;
+        len -= take;
+        if (self->num_partial == EVENT_SIZE) {
+            count += simulkeys_feed(self->sk,
+                                    (struct input_event *)self->partial, 1,
+                                    now, out);
+            self->num_partial = 0;
+        }
+    }
+    if (self->num_partial) {
+        // Still not a whole event
+        PyBuffer_Release(&in);
+        return finish_output(bytes, count);
+    }
+    // Straight from the caller's buffer, which is only aligned by chance
+    const size_t num_events = len / EVENT_SIZE;
+    if ((uintptr_t)data % _Alignof(struct input_event) == 0) {
+        count += simulkeys_feed(self->sk, (const struct input_event *)data,
+                                num_events, now, out + count);
+    } else {
+        size_t i;
+        for (i = 0; i < num_events; i++) {
+            struct input_event event;
+            memcpy(&event, data + i * EVENT_SIZE, EVENT_SIZE);
+            count += simulkeys_feed(self->sk, &event, 1, now, out + count);
+        }
+    }
+    self->num_partial = len % EVENT_SIZE;
+    memcpy(self->partial, data + num_events * EVENT_SIZE, self->num_partial);
+    PyBuffer_Release(&in);
+    return finish_output(bytes, count);
+}
+
+static PyObject *Engine_on_deadline(EngineObject *self, PyObject *args) {
+    PyObject *now_obj = NULL;
+    uint64_t now;
+    if (check_engine(self) == -1 || !PyArg_ParseTuple(args, "|O", &now_obj) ||
+        parse_now(now_obj, &now) == -1)
+        return NULL;
+    struct input_event *out;
+    PyObject *bytes = new_output(SIMULKEYS_OUT_MAX(0), &out);
+    if (!bytes)
+        return NULL;
+    return finish_output(bytes, simulkeys_on_deadline(self->sk, now, out));
+}
+
+static PyObject *Engine_reset(EngineObject *self, PyObject *unused) {
+    if (check_engine(self) == -1)
+        return NULL;
+    struct input_event *out;
+    PyObject *bytes = new_output(SIMULKEYS_OUT_MAX(0), &out);
+    if (!bytes)
+        return NULL;
+    self->num_partial = 0;
+    return finish_output(bytes, simulkeys_reset(self->sk, out));
+}
+
+static PyObject *Engine_next_deadline(EngineObject *self, PyObject *unused) {
+    if (check_engine(self) == -1)
+        return NULL;
+    const uint64_t deadline = simulkeys_next_deadline(self->sk);
+    if (deadline == CHORD_NO_DEADLINE)
+        Py_RETURN_NONE;
+    return PyLong_FromUnsignedLongLong(deadline);
+}
+
+static PyObject *Engine_timeout(EngineObject *self, PyObject *args) {
+    PyObject *now_obj = NULL;
+    uint64_t now;
+    if (check_engine(self) == -1 || !PyArg_ParseTuple(args, "|O", &now_obj) ||
+        parse_now(now_obj, &now) == -1)
+        return NULL;
+    const uint64_t deadline = simulkeys_next_deadline(self->sk);
+    if (deadline == CHORD_NO_DEADLINE)
+        Py_RETURN_NONE;
+    return PyFloat_FromDouble(deadline > now ? (deadline - now) / 1e9 : 0.0);
+}
+
+static PyMethodDef Engine_methods[] = {
+    {"feed", (PyCFunction)Engine_feed, METH_VARARGS,
+     "feed(data, now=None) -> bytes\n\nRuns a buffer of input_events through "
+     "the engine, returns the events to write."},
+    {"on_deadline", (PyCFunction)Engine_on_deadline, METH_VARARGS,
+     "on_deadline(now=None) -> bytes\n\nWrites the held back presses whose "
+     "threshold ran out."},
+    {"reset", (PyCFunction)Engine_reset, METH_NOARGS,
+     "reset() -> bytes\n\nDrops held back presses, releases targets still "
+     "down."},
+    {"next_deadline", (PyCFunction)Engine_next_deadline, METH_NOARGS,
+     "next_deadline() -> int | None\n\nCLOCK_MONOTONIC ns of the next "
+     "deadline."},
+    {"timeout", (PyCFunction)Engine_timeout, METH_VARARGS,
+     "timeout(now=None) -> float | None\n\nSeconds until the next deadline, "
+     "for select()."},
+    {NULL},
+};
+
+static PyTypeObject EngineType = {
+    PyVarObject_HEAD_INIT(NULL, 0).tp_name = "simulkeys.Engine",
+    .tp_doc       = "Engine(rules=None, threshold=0)\n\nChord engine for one "
+                    "input stream, rules default to chord_rules.h (None, an "
+                    "empty list is an error).",
+    .tp_basicsize = sizeof(EngineObject),
+    .tp_flags     = Py_TPFLAGS_DEFAULT,
+    .tp_new       = PyType_GenericNew,
+    .tp_init      = (initproc)Engine_init,
+    .tp_dealloc   = (destructor)Engine_dealloc,
+    .tp_methods   = Engine_methods,
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// MODULE
+////////////////////////////////////////////////////////////////////////////////
+static struct PyModuleDef simulkeys_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "simulkeys",
+    .m_doc  = "Native chord engine (libsimulkeys) for input_event buffers.",
+    .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_simulkeys(void) {
+    if (PyType_Ready(&EngineType) < 0)
+        return NULL;
+    PyObject *m = PyModule_Create(&simulkeys_module);
+    if (!m)
+        return NULL;
+    Py_INCREF(&EngineType);
+    if (PyModule_AddObject(m, "Engine", (PyObject *)&EngineType) < 0 ||
+        PyModule_AddIntConstant(m, "EVENT_SIZE", EVENT_SIZE) < 0) {
+        Py_DECREF(&EngineType);
+        Py_DECREF(m);
+        return NULL;
+    }
+    return m;
+}
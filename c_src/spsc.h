@@ -0,0 +1,79 @@
+#ifndef SIMUL_SPSC_H
+#define SIMUL_SPSC_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Lock-free single-producer/single-consumer ring index.
+// Only the positions live here, the slots themselves are an array of
+// `capacity` (a power of two) elements owned by the user:
+//
+//   size_t i = spsc_produce_slot(&ring);  // producer thread
+//   if (i != SPSC_FULL) { fill(&slots[i]); spsc_produce(&ring); }
+//
+//   size_t i = spsc_consume_slot(&ring);  // consumer thread
+//   if (i != SPSC_EMPTY) { use(&slots[i]); spsc_consume(&ring); }
+//
+// A slot stays owned by its thread until the matching `spsc_produce` or
+// `spsc_consume`, so it can be filled/used in place (no copies). Both
+// positions sit on their own cache line, next to the position of the other
+// side that was last seen, so the threads only share a line when the cached
+// value runs out.
+
+#define SPSC_CACHE_LINE 64
+#define SPSC_FULL ((size_t)-1)
+#define SPSC_EMPTY ((size_t)-1)
+
+struct spsc {
+    // Written by the producer
+    _Alignas(SPSC_CACHE_LINE) atomic_size_t tail;
+    size_t cached_head;
+    // Written by the consumer
+    _Alignas(SPSC_CACHE_LINE) atomic_size_t head;
+    size_t cached_tail;
+    // Read only
+    _Alignas(SPSC_CACHE_LINE) size_t mask;
+};
+
+static inline void spsc_init(struct spsc *ring, size_t capacity) {
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->head, 0);
+    ring->cached_head = 0;
+    ring->cached_tail = 0;
+    ring->mask        = capacity - 1;
+}
+
+static inline size_t spsc_produce_slot(struct spsc *ring) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - ring->cached_head > ring->mask) {
+        ring->cached_head =
+            atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail - ring->cached_head > ring->mask)
+            return SPSC_FULL;
+    }
+    return tail & ring->mask;
+}
+
+static inline void spsc_produce(struct spsc *ring) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+static inline size_t spsc_consume_slot(struct spsc *ring) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head == ring->cached_tail) {
+        ring->cached_tail =
+            atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head == ring->cached_tail)
+            return SPSC_EMPTY;
+    }
+    return head & ring->mask;
+}
+
+static inline void spsc_consume(struct spsc *ring) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+#endif
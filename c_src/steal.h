@@ -0,0 +1,94 @@
+#ifndef SIMUL_STEAL_H
+#define SIMUL_STEAL_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Lock-free work-stealing deque of task indices (Chase-Lev, fixed capacity).
+// Every worker thread owns one: only the owner pushes and takes, at the
+// bottom, while any other thread can steal from the top once its own deque
+// ran dry:
+//
+//   steal_push(&own, task);                 // owner thread
+//   size_t task = steal_take(&own);         // owner thread, STEAL_EMPTY
+//   size_t task = steal(&others[v]);        // any thread, STEAL_EMPTY or
+//                                           // STEAL_RETRY (lost a race)
+//
+// The owner and the thieves only contend for the very last task. The slots
+// are an array of `capacity` (a power of two) elements owned by the user.
+
+#define STEAL_CACHE_LINE 64
+#define STEAL_EMPTY ((size_t)-1)
+#define STEAL_RETRY ((size_t)-2)
+
+struct steal_deque {
+    // Written by thieves (and the owner for the last task)
+    _Alignas(STEAL_CACHE_LINE) atomic_long top;
+    // Written by the owner
+    _Alignas(STEAL_CACHE_LINE) atomic_long bottom;
+    // Read only
+    _Alignas(STEAL_CACHE_LINE) atomic_size_t *slots;
+    long mask;
+};
+
+static inline void steal_init(struct steal_deque *dq, atomic_size_t *slots,
+                              size_t capacity) {
+    atomic_init(&dq->top, 0);
+    atomic_init(&dq->bottom, 0);
+    dq->slots = slots;
+    dq->mask  = capacity - 1;
+}
+
+// Owner only, -1 if full
+static inline int steal_push(struct steal_deque *dq, size_t task) {
+    const long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+    const long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    if (b - t > dq->mask)
+        return -1;
+    atomic_store_explicit(&dq->slots[b & dq->mask], task,
+                          memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+    return 0;
+}
+
+// Owner only, newest task first
+static inline size_t steal_take(struct steal_deque *dq) {
+    const long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&dq->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+    if (t > b) {
+        atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+        return STEAL_EMPTY;
+    }
+    size_t task =
+        atomic_load_explicit(&dq->slots[b & dq->mask], memory_order_relaxed);
+    if (t == b) {
+        // Last one, race the thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+                                                     memory_order_seq_cst,
+                                                     memory_order_relaxed))
+            task = STEAL_EMPTY;
+        atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+// Any thread, oldest task first
+static inline size_t steal(struct steal_deque *dq) {
+    long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    const long b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+    if (t >= b)
+        return STEAL_EMPTY;
+    const size_t task =
+        atomic_load_explicit(&dq->slots[t & dq->mask], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed))
+        return STEAL_RETRY;
+    return task;
+}
+
+#endif
@@ -0,0 +1,159 @@
+#define _GNU_SOURCE
+#include <linux/input.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "daemon_harness.h"
+
+// Backpressure test for `simul_daemon`: its consumer stops reading for
+// STALL_MS while the daemon gets typing (taps of A with repeats in between)
+// mixed with a lot of pointer motion. Checked:
+// - every key press and release comes out, in order (repeats may be dropped,
+//   pointer motion too unless `-p keep`)
+// - the daemon stays responsive meanwhile: its SIGUSR1 stats are answered
+//   right away, not once the consumer reads again. Not with `-p keep`, once
+//   the motion fills its queue it has to wait, but then all of it comes out.
+//
+// usage: test_backpressure STALL_MS DAEMON_BINARY [DAEMON_ARGS...]
+
+#define TAPS 500
+#define REPEATS 4
+#define MOTION_FRAMES 40  // Per tap
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n == -1)
+            err_exit("Failed on write");
+        p += n;
+        len -= n;
+    }
+}
+
+static void write_key(int fd, int32_t value) {
+    const struct input_event frame[] = {
+        {.type = EV_KEY, .code = KEY_A, .value = value},
+        {.type = EV_SYN, .code = SYN_REPORT, .value = 0},
+    };
+    write_all(fd, frame, sizeof(frame));
+}
+
+static void write_motion(int fd) {
+    const struct input_event frame[] = {
+        {.type = EV_REL, .code = REL_X, .value = 1},
+        {.type = EV_REL, .code = REL_Y, .value = -1},
+        {.type = EV_SYN, .code = SYN_REPORT, .value = 0},
+    };
+    write_all(fd, frame, sizeof(frame));
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3 || argc > MAX_ARGS) {
+        fprintf(stderr, "usage: %s STALL_MS DAEMON_BINARY [DAEMON_ARGS...]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    const uint64_t stall_ns = strtoull(argv[1], NULL, 10) * MS;
+    char *args[MAX_ARGS + 2];
+    bool keep = false;
+    int a;
+    for (a = 3; a < argc; a++)
+        keep |= !strcmp(argv[a], "keep");
+    daemon_args(args, argv + 2, argc - 2);
+
+    int in, out, err;
+    const pid_t pid = spawn_daemon(args, &in, &out, &err);
+    FILE *errf      = fdopen(err, "r");
+
+    // Stalled consumer: type everything while nobody reads (in a child of
+    // its own, a daemon waiting for room stops reading as well)
+    const uint64_t start = now_ns();
+    const pid_t typist   = fork();
+    if (typist == -1)
+        err_exit("Failed on fork");
+    if (!typist) {
+        int t, m;
+        for (t = 0; t < TAPS; t++) {
+            write_key(in, 1);
+            for (m = 0; m < REPEATS; m++)
+                write_key(in, 2);
+            write_key(in, 0);
+            for (m = 0; m < MOTION_FRAMES; m++)
+                write_motion(in);
+        }
+        exit(EXIT_SUCCESS);
+    }
+    usleep(100000);
+
+    // Responsive while still stalled? (stdin still open, at its end the
+    // daemon waits for everything to be written)
+    char line[512]    = "";
+    uint64_t answered = 0;
+    if (!keep) {
+        const uint64_t asked = now_ns();
+        kill(pid, SIGUSR1);
+        while (fgets(line, sizeof(line), errf) && strncmp(line, "stats:", 6))
+            fputs(line, stdout);  // Alerts
+        answered = now_ns() - asked;
+        printf("stats answered in %.2fms while stalled\n", answered / 1e6);
+        printf("%s", line);
+    }
+    while (now_ns() - start < stall_ns)
+        usleep(1000);
+
+    // Consumer is back
+    close(in);
+    struct input_event event;
+    size_t got = 0;
+    ssize_t n;
+    unsigned long presses = 0, releases = 0, repeats = 0, motion = 0;
+    bool ordered = true;
+    int32_t last = 0;
+    while ((n = read(out, (char *)&event + got, sizeof(event) - got)) > 0) {
+        got += n;
+        if (got < sizeof(event))
+            continue;
+        got = 0;
+        if (event.type == EV_REL)
+            motion++;
+        if (event.type != EV_KEY || event.code != KEY_A)
+            continue;
+        if (event.value == 2) {
+            repeats++;
+            ordered &= last == 1;
+            continue;
+        }
+        ordered &= event.value != last;
+        last = event.value;
+        event.value ? presses++ : releases++;
+    }
+    while (fgets(line, sizeof(line), errf))
+        fputs(line, stdout);
+    waitpid(typist, NULL, 0);
+    reap_daemon(pid, -1, out);
+
+    printf("out: %lu presses, %lu releases, %lu/%d repeats, %lu/%d motion\n",
+           presses, releases, repeats, TAPS * REPEATS, motion,
+           TAPS * MOTION_FRAMES * 2);
+    const bool ok = presses == TAPS && releases == TAPS && ordered &&
+                    (keep ? motion == TAPS * MOTION_FRAMES * 2
+                          : answered < stall_ns / 2);
+    if (!ok)
+        fprintf(stderr, "FAILED\n");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,367 @@
+#include <linux/input.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chord.h"
+#include "chord_rules.h"
+#include "chord_static.h"
+
+// Property test for the chord engine (`chord.h`), on a virtual clock so no
+// time is spent sleeping. Every input is decoded into a valid key stream
+// (source keys, other keys, repeats, non-key events, random gaps) and fed to
+// the engine the way the daemon does: deadlines are expired exactly when
+// they come due. The output is checked for:
+// - every press having a matching release, no key pressed twice
+// - no stuck target: targets down in the output match the engine's
+//   `target_down` (the old `TARGETS_STATE`), nothing is left down at the end
+// - non-source events coming out in the order they came in
+// - a source press never being held back longer than the threshold
+// - the compile-time specialized engine (`chord_static.h`) agreeing with the
+//   runtime one
+// - no call writing more than CHORD_MAX_OUT events
+// Every stream goes through three rule sets: the one of `chord_rules.h`, a
+// mixed one (2, 3 and 4 source keys, so chords fire while keys of other
+// rules are held back) and a full one (CHORD_MAX_RULES rules of
+// CHORD_MAX_SOURCES keys, up to CHORD_MAX_PENDING presses held back).
+//
+// Built with `-DSIMUL_LIBFUZZER` (clang -fsanitize=fuzzer) this is a
+// libFuzzer target, otherwise `main` runs random streams and reports the
+// throughput of the engine alone.
+//
+// usage: test_fuzz_chord [STREAMS] [EVENTS_PER_STREAM]
+
+#define DEFAULT_STREAMS 20000
+#define DEFAULT_EVENTS 2000
+#define MAX_EVENTS 4096  // Per stream, longer inputs are cut
+#define GAP_STEPS 64     // Gaps go up to 4 thresholds in GAP_STEPS steps
+
+// Rule sets fuzzed next to the one of `chord_rules.h`
+#define MIXED_RULES                                                          \
+    {.sources = {KEY_J, KEY_K}, .num_sources = 2, .target = KEY_ESC},        \
+    {.sources = {KEY_D, KEY_F, KEY_G}, .num_sources = 3, .target = KEY_TAB}, \
+    {.sources     = {KEY_Q, KEY_W, KEY_E, KEY_R},                            \
+     .num_sources = 4,                                                       \
+     .target      = KEY_BACKSPACE},
+#define FULL_RULE(a, b, c, d, t) \
+    {.sources = {a, b, c, d}, .num_sources = 4, .target = t},
+#define FULL_RULES                                                 \
+    FULL_RULE(KEY_Q, KEY_W, KEY_E, KEY_R, KEY_F1)                  \
+    FULL_RULE(KEY_T, KEY_Y, KEY_U, KEY_I, KEY_F2)                  \
+    FULL_RULE(KEY_O, KEY_P, KEY_LEFTBRACE, KEY_RIGHTBRACE, KEY_F3) \
+    FULL_RULE(KEY_D, KEY_F, KEY_G, KEY_H, KEY_F4)                  \
+    FULL_RULE(KEY_J, KEY_K, KEY_L, KEY_SEMICOLON, KEY_F5)          \
+    FULL_RULE(KEY_Z, KEY_X, KEY_C, KEY_V, KEY_F6)                  \
+    FULL_RULE(KEY_B, KEY_N, KEY_M, KEY_COMMA, KEY_F7)              \
+    FULL_RULE(KEY_1, KEY_2, KEY_3, KEY_4, KEY_F8)
+
+CHORD_STATIC_ENGINE(simul, SIMUL_THRESHOLD, SIMUL_RULES)
+CHORD_STATIC_ENGINE(mixed, SIMUL_THRESHOLD, MIXED_RULES)
+CHORD_STATIC_ENGINE(full, SIMUL_THRESHOLD, FULL_RULES)
+
+// A rule set, run by the runtime engine and its static one side by side
+struct rule_set {
+    const char *name;
+    const struct chord_config *static_cfg;
+    size_t (*static_feed)(struct chord_state *, const struct input_event *,
+                          uint64_t, struct input_event *);
+    size_t (*static_expire)(struct chord_state *, uint64_t,
+                            struct input_event *);
+    struct chord_config cfg;
+    // Input alphabet: every source key, two other keys, one non-key event
+    uint16_t symbols[CHORD_MAX_RULES * CHORD_MAX_SOURCES + 3];
+    size_t num_symbols;
+    uint64_t engine_ns, engine_events;
+    uint64_t chords;  // Target presses written
+};
+
+#define RULE_SET(rules_name, engine)    \
+    {.name          = rules_name,       \
+     .static_cfg    = &engine##_config, \
+     .static_feed   = engine##_feed,    \
+     .static_expire = engine##_expire}
+static struct rule_set RULE_SETS[] = {
+    RULE_SET("chord_rules.h", simul),
+    RULE_SET("mixed", mixed),
+    RULE_SET("full", full),
+};
+#define NUM_RULE_SETS (sizeof(RULE_SETS) / sizeof(RULE_SETS[0]))
+
+struct fuzz {
+    struct rule_set *set;
+    const struct chord_config *cfg;
+    // Decoded stream
+    struct input_event events[MAX_EVENTS + KEY_CNT];
+    uint64_t times[MAX_EVENTS + KEY_CNT];
+    size_t num_events;
+    // Output checks
+    bool down[KEY_CNT];
+    uint64_t pressed_at[KEY_CNT];  // Input time of held back source presses
+    struct input_event passed[MAX_EVENTS + KEY_CNT];  // Non-source events
+    size_t num_passed, next_passed;
+};
+
+static struct fuzz FUZZ;
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void fail(const char *what, const struct input_event *ev) {
+    fprintf(stderr, "Invariant broken: %s (type %u code %u value %d)\n", what,
+            ev->type, ev->code, ev->value);
+    abort();
+}
+
+static bool is_target(const struct chord_config *cfg, uint16_t code) {
+    size_t r;
+    for (r = 0; r < cfg->num_rules; r++)
+        if (cfg->rules[r].target == code)
+            return true;
+    return false;
+}
+
+static void rule_sets_init(void) {
+    size_t i, r, s;
+    for (i = 0; i < NUM_RULE_SETS; i++) {
+        struct rule_set *set = &RULE_SETS[i];
+        if (chord_config_set(&set->cfg, set->static_cfg->rules,
+                             set->static_cfg->num_rules,
+                             set->static_cfg->threshold_ns) == -1) {
+            perror(set->name);
+            exit(EXIT_FAILURE);
+        }
+        for (r = 0; r < set->cfg.num_rules; r++)
+            for (s = 0; s < set->cfg.rules[r].num_sources; s++)
+                set->symbols[set->num_symbols++] =
+                    set->cfg.rules[r].sources[s];
+        set->symbols[set->num_symbols++] = KEY_A;
+        set->symbols[set->num_symbols++] = KEY_S;
+        set->symbols[set->num_symbols++] = KEY_RESERVED;  // Stands for EV_MSC
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// DECODE
+////////////////////////////////////////////////////////////////////////////////
+static void push_event(struct fuzz *f, uint64_t t, uint16_t type,
+                       uint16_t code, int32_t value) {
+    const struct timeval tv = {.tv_sec  = t / 1000000000,
+                               .tv_usec = t % 1000000000 / 1000};
+    f->times[f->num_events] = t;
+    f->events[f->num_events++] =
+        (struct input_event){.time = tv, .type = type, .code = code,
+                             .value = value};
+}
+
+// Two bytes per event: symbol (+ repeat and chain flags) and gap before it.
+// A chained event is the next source key of the same rule as the last one,
+// after a short gap, otherwise chords of 3 or 4 keys would hardly ever
+// complete. Key state is tracked so the stream is one a real keyboard could
+// produce, every key still down at the end gets released.
+static void decode(struct fuzz *f, const uint8_t *data, size_t size) {
+    bool down[KEY_CNT] = {0};
+    uint64_t t         = 0;
+    uint16_t last      = KEY_RESERVED;  // Last source key
+    size_t i;
+    f->num_events = 0;
+    for (i = 0; i + 1 < size && f->num_events < MAX_EVENTS; i += 2) {
+        uint16_t code = f->set->symbols[data[i] % f->set->num_symbols];
+        size_t steps  = data[i + 1] % GAP_STEPS;
+        if (data[i] & 0x40 && last != KEY_RESERVED) {
+            const struct chord_rule *rule =
+                &f->cfg->rules[f->cfg->rule_of[last]];
+            code  = rule->sources[(f->cfg->bit_of[last] + 1) %
+                                 rule->num_sources];
+            steps = data[i + 1] % (GAP_STEPS / 8);
+        }
+        if (chord_is_source_key(f->cfg, code))
+            last = code;
+        t += f->cfg->threshold_ns * 4 / GAP_STEPS * steps;
+        if (code == KEY_RESERVED) {
+            push_event(f, t, EV_MSC, MSC_SCAN, data[i]);
+            continue;
+        }
+        const int32_t value = !down[code] ? 1 : data[i] & 0x80 ? 2 : 0;
+        down[code]          = value != 0;
+        push_event(f, t, EV_KEY, code, value);
+        push_event(f, t, EV_SYN, SYN_REPORT, 0);
+    }
+    for (i = 0; i < KEY_CNT; i++) {
+        if (!down[i])
+            continue;
+        t += f->cfg->threshold_ns / 4;
+        push_event(f, t, EV_KEY, i, 0);
+        push_event(f, t, EV_SYN, SYN_REPORT, 0);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// CHECKS
+////////////////////////////////////////////////////////////////////////////////
+static void check_output(struct fuzz *f, const struct input_event *out,
+                         size_t n, uint64_t now) {
+    size_t i;
+    if (n > CHORD_MAX_OUT)
+        fail("more than CHORD_MAX_OUT events written", out);
+    for (i = 0; i < n; i++) {
+        const struct input_event *ev = &out[i];
+        if (ev->type == EV_SYN)
+            continue;
+        if (ev->type != EV_KEY || (!chord_is_source_key(f->cfg, ev->code) &&
+                                   !is_target(f->cfg, ev->code))) {
+            const struct input_event *want = &f->passed[f->next_passed++];
+            if (f->next_passed > f->num_passed || want->type != ev->type ||
+                want->code != ev->code || want->value != ev->value)
+                fail("non-source event out of order", ev);
+        }
+        if (ev->type != EV_KEY)
+            continue;
+        switch (ev->value) {
+            case 1:
+                if (f->down[ev->code])
+                    fail("pressed twice", ev);
+                f->down[ev->code] = true;
+                f->set->chords += is_target(f->cfg, ev->code);
+                if (chord_is_source_key(f->cfg, ev->code) &&
+                    now - f->pressed_at[ev->code] > f->cfg->threshold_ns)
+                    fail("held back longer than the threshold", ev);
+                break;
+            case 0:
+                if (!f->down[ev->code])
+                    fail("released while up", ev);
+                f->down[ev->code] = false;
+                break;
+            default:
+                if (!f->down[ev->code])
+                    fail("repeated while up", ev);
+                break;
+        }
+    }
+}
+
+static void check_targets(struct fuzz *f, const struct chord_state *st) {
+    size_t r;
+    for (r = 0; r < f->cfg->num_rules; r++) {
+        const struct input_event ev = {.type = EV_KEY,
+                                       .code = f->cfg->rules[r].target};
+        if (st->rules[r].target_down != f->down[ev.code])
+            fail("target state out of sync", &ev);
+    }
+}
+
+static void check_same(const struct input_event *a, size_t n,
+                       const struct input_event *b, size_t m) {
+    if (n != m || memcmp(a, b, n * sizeof(*a)))
+        fail("static engine disagrees", n ? a : b);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// RUN
+////////////////////////////////////////////////////////////////////////////////
+static void run(struct fuzz *f, struct rule_set *set, const uint8_t *data,
+                size_t size) {
+    struct chord_state st, st_static;
+    // Room to spare, so going over CHORD_MAX_OUT is caught, not a crash
+    struct input_event out[2 * CHORD_MAX_OUT], out_static[2 * CHORD_MAX_OUT];
+    size_t i, n;
+
+    f->set = set;
+    f->cfg = &set->cfg;
+    decode(f, data, size);
+    chord_state_init(&st);
+    chord_state_init(&st_static);
+    memset(f->down, 0, sizeof(f->down));
+    f->num_passed = f->next_passed = 0;
+    for (i = 0; i < f->num_events; i++) {
+        const struct input_event *ev = &f->events[i];
+        if (ev->type != EV_SYN &&
+            (ev->type != EV_KEY || !chord_is_source_key(f->cfg, ev->code)))
+            f->passed[f->num_passed++] = *ev;
+    }
+
+    // Engine alone first, for the throughput numbers
+    const uint64_t start = now_ns();
+    for (i = 0; i < f->num_events; i++)
+        chord_feed(f->cfg, &st, &f->events[i], f->times[i], out);
+    set->engine_ns += now_ns() - start;
+    set->engine_events += f->num_events;
+
+    chord_state_init(&st);
+    for (i = 0; i < f->num_events; i++) {
+        const struct input_event *ev = &f->events[i];
+        // Timer fires right on the deadline
+        uint64_t deadline;
+        while ((deadline = chord_next_deadline(&st)) <= f->times[i]) {
+            n = chord_expire(f->cfg, &st, deadline, out);
+            check_same(out, n, out_static,
+                       set->static_expire(&st_static, deadline, out_static));
+            check_output(f, out, n, deadline);
+        }
+        if (ev->type == EV_KEY && chord_is_source_key(f->cfg, ev->code) &&
+            ev->value == 1)
+            f->pressed_at[ev->code] = f->times[i];
+        n = chord_feed(f->cfg, &st, ev, f->times[i], out);
+        check_same(out, n, out_static,
+                   set->static_feed(&st_static, ev, f->times[i], out_static));
+        check_output(f, out, n, f->times[i]);
+        check_targets(f, &st);
+    }
+    // Every input key got released, so nothing may be held back or down
+    if (st.num_pending) {
+        const struct input_event ev = {.type = EV_KEY,
+                                       .code = st.pending[0].code};
+        fail("press still held back at the end", &ev);
+    }
+    for (i = 0; i < KEY_CNT; i++) {
+        const struct input_event ev = {.type = EV_KEY, .code = i};
+        if (f->down[i])
+            fail("stuck key", &ev);
+    }
+    if (f->next_passed != f->num_passed)
+        fail("non-source event lost", &f->passed[f->next_passed]);
+}
+
+#ifdef SIMUL_LIBFUZZER
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    size_t s;
+    if (!RULE_SETS[0].num_symbols)
+        rule_sets_init();
+    for (s = 0; s < NUM_RULE_SETS; s++)
+        run(&FUZZ, &RULE_SETS[s], data, size);
+    return 0;
+}
+#else
+int main(int argc, char *argv[]) {
+    const size_t streams = argc > 1 ? strtoul(argv[1], NULL, 10)
+                                    : DEFAULT_STREAMS;
+    size_t size = 2 * (argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_EVENTS);
+    if (size > 2 * MAX_EVENTS)
+        size = 2 * MAX_EVENTS;
+    static uint8_t data[2 * MAX_EVENTS];
+    uint64_t seed = 1;
+    size_t i, j, s;
+
+    rule_sets_init();
+    for (i = 0; i < streams; i++) {
+        for (j = 0; j < size; j++) {
+            seed    = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            data[j] = seed >> 56;
+        }
+        for (s = 0; s < NUM_RULE_SETS; s++)
+            run(&FUZZ, &RULE_SETS[s], data, size);
+    }
+    for (s = 0; s < NUM_RULE_SETS; s++)
+        printf("%-13s %zu streams, %lu events, %lu chords, all invariants "
+               "hold, engine %.0f events/s\n",
+               RULE_SETS[s].name, streams, RULE_SETS[s].engine_events,
+               RULE_SETS[s].chords,
+               RULE_SETS[s].engine_events * 1e9 / RULE_SETS[s].engine_ns);
+    return EXIT_SUCCESS;
+}
+#endif
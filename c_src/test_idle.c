@@ -0,0 +1,147 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <linux/input.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "daemon_harness.h"
+
+// Idle test for `simul_daemon`: after some typing (one source key press held
+// past the threshold, one tapped, one other key) nothing is pending anymore,
+// so over the next SECONDS the daemon must not wake up at all. Checked twice:
+// - its own wakeup counters (SIGUSR1 stats), and no timer armed
+// - the context switches of all its threads in /proc, so wakeups the
+//   counters can't see (timer threads, signals, ...) are caught as well
+// The held press must have armed exactly one deadline.
+//
+// usage: test_idle SECONDS DAEMON_BINARY [DAEMON_ARGS...]
+
+
+struct stats {
+    unsigned long wakeups, input, decision, timer_arms, timer_fires;
+};
+
+static pid_t PID;
+static FILE *STATS_IN;
+
+static void sleep_ns(uint64_t ns) {
+    struct timespec ts = {.tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000};
+    nanosleep(&ts, NULL);
+}
+
+static void write_frame(int fd, uint16_t code, int32_t value) {
+    const struct input_event frame[] = {
+        {.type = EV_KEY, .code = code, .value = value},
+        {.type = EV_SYN, .code = SYN_REPORT, .value = 0},
+    };
+    if (write(fd, frame, sizeof(frame)) == -1)
+        err_exit("Failed on write");
+}
+
+static struct stats read_stats(void) {
+    struct stats st;
+    char line[256];
+    if (kill(PID, SIGUSR1) == -1)
+        err_exit("Failed on kill");
+    while (fgets(line, sizeof(line), STATS_IN)) {
+        if (sscanf(line,
+                   "stats: wakeups %lu (input %lu, decision %lu), timer "
+                   "armed %lu, fired %lu",
+                   &st.wakeups, &st.input, &st.decision, &st.timer_arms,
+                   &st.timer_fires) == 5)
+            return st;
+    }
+    fprintf(stderr, "No stats from the daemon\n");
+    exit(EXIT_FAILURE);
+}
+
+// Context switches of all threads of the daemon
+static unsigned long context_switches(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", PID);
+    DIR *d = opendir(path);
+    if (!d)
+        err_exit("Failed on opendir");
+    unsigned long total = 0;
+    struct dirent *ent;
+    while ((ent = readdir(d))) {
+        if (ent->d_name[0] == '.')
+            continue;
+        char status[sizeof(path) + sizeof(ent->d_name) + sizeof("/status")];
+        char line[128];
+        snprintf(status, sizeof(status), "%s/%s/status", path, ent->d_name);
+        FILE *f = fopen(status, "r");
+        if (!f)
+            continue;
+        unsigned long n;
+        while (fgets(line, sizeof(line), f))
+            if (sscanf(line, "voluntary_ctxt_switches: %lu", &n) == 1 ||
+                sscanf(line, "nonvoluntary_ctxt_switches: %lu", &n) == 1)
+                total += n;
+        fclose(f);
+    }
+    closedir(d);
+    return total;
+}
+
+int main(int argc, char *argv[]) {
+    // A whole number of seconds, at least 1 (strtoull takes "-1" as well)
+    char *end              = "";
+    const uint64_t seconds = argc > 1 && isdigit((unsigned char)argv[1][0])
+                                 ? strtoull(argv[1], &end, 10)
+                                 : 0;
+    if (argc < 3 || argc > MAX_ARGS || !seconds || *end ||
+        seconds > UINT64_MAX / 1000000000) {
+        fprintf(stderr, "usage: %s SECONDS DAEMON_BINARY [DAEMON_ARGS...]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    char *args[MAX_ARGS + 2];
+    daemon_args(args, argv + 2, argc - 2);
+
+    int in, out, err;
+    PID      = spawn_daemon(args, &in, &out, &err);
+    STATS_IN = fdopen(err, "r");
+
+    // Typing: J held past the threshold (its timer fires), J tapped (flushed
+    // on release), another key
+    write_frame(in, KEY_J, 1);
+    sleep_ns(100 * MS);
+    write_frame(in, KEY_J, 0);
+    write_frame(in, KEY_J, 1);
+    write_frame(in, KEY_J, 0);
+    write_frame(in, KEY_A, 1);
+    write_frame(in, KEY_A, 0);
+    sleep_ns(100 * MS);
+
+    const struct stats before = read_stats();
+    sleep_ns(10 * MS);  // Let it go back to sleep after the signal
+    const unsigned long switches_before = context_switches();
+    printf("typing: wakeups %lu, timer armed %lu, fired %lu\n", before.wakeups,
+           before.timer_arms, before.timer_fires);
+
+    sleep_ns(seconds * 1000000000);
+
+    const unsigned long switches = context_switches() - switches_before;
+    const struct stats after     = read_stats();
+    const unsigned long wakeups  = after.wakeups - before.wakeups;
+    const unsigned long arms     = after.timer_arms - before.timer_arms;
+    printf("idle %lus: wakeups %lu, timer armed %lu, context switches %lu\n",
+           (unsigned long)seconds, wakeups, arms, switches);
+
+    reap_daemon(PID, in, out);
+
+    // Both J presses are held back, only the first one outlives its deadline
+    // (the second is released first), so exactly one deadline fires
+    const bool ok = !wakeups && !arms && !switches && before.timer_fires == 1;
+    if (!ok)
+        fprintf(stderr, "FAILED\n");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,157 @@
+#define _GNU_SOURCE
+#include <linux/input.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "daemon_harness.h"
+
+// Test of the latency self-test of `simul_daemon -l`: types on its stdin
+// with CLOCK_MONOTONIC timestamps, like a device would, then reads its
+// SIGUSR1 stats back. Checked:
+// - every key press/release written lands in the right histogram: passed
+//   through (A taps, releases), flushed (J taps, J held past the threshold)
+//   and chord target (J+K -> ESC)
+// - held J presses are flushed no earlier than the threshold
+// - passed through keys stay within BUDGET_US, except one press stamped
+//   well in the past, which has to be flagged
+// Uses the rules of `chord_rules.h` (J+K -> ESC, 50ms).
+//
+// usage: test_latency BUDGET_US DAEMON_BINARY [DAEMON_ARGS...]
+
+#define THRESHOLD_NS (50 * MS)
+#define TAPS 200
+#define J_TAPS 20
+#define J_HOLDS 5
+#define CHORDS 10
+
+struct class_stats {
+    unsigned long keys, over;
+    double mean, p50, p99, max;
+};
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_ns(uint64_t ns) {
+    struct timespec ts = {.tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000};
+    nanosleep(&ts, NULL);
+}
+
+// Stamped `age` ns in the past
+static void write_frame(int fd, uint16_t code, int32_t value, uint64_t age) {
+    const uint64_t t           = now_ns() - age;
+    const struct timeval time  = {.tv_sec  = t / 1000000000,
+                                  .tv_usec = t % 1000000000 / 1000};
+    const struct input_event frame[] = {
+        {.time = time, .type = EV_KEY, .code = code, .value = value},
+        {.time = time, .type = EV_SYN, .code = SYN_REPORT, .value = 0},
+    };
+    if (write(fd, frame, sizeof(frame)) == -1)
+        err_exit("Failed on write");
+}
+
+static void tap(int fd, uint16_t code) {
+    write_frame(fd, code, 1, 0);
+    sleep_ns(MS);
+    write_frame(fd, code, 0, 0);
+    sleep_ns(MS);
+}
+
+static bool parse(const char *line, const char *name, struct class_stats *st) {
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "latency %s: ", name);
+    if (strncmp(line, prefix, strlen(prefix)))
+        return false;
+    memset(st, 0, sizeof(*st));
+    return sscanf(line + strlen(prefix),
+                  "%lu keys, mean %lfms, p50 %lfms, p99 %lfms, max %lfms, %lu "
+                  "over",
+                  &st->keys, &st->mean, &st->p50, &st->p99, &st->max,
+                  &st->over) >= 5;
+}
+
+static void print(const char *name, const struct class_stats *st) {
+    printf("%-15s %4lu keys  mean %7.3fms  p50 %7.3fms  p99 %7.3fms  max "
+           "%7.3fms\n",
+           name, st->keys, st->mean, st->p50, st->p99, st->max);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3 || argc > MAX_ARGS) {
+        fprintf(stderr, "usage: %s BUDGET_US DAEMON_BINARY [DAEMON_ARGS...]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    const double budget_ms = strtoul(argv[1], NULL, 10) / 1e3;
+    char *args[MAX_ARGS + 4];
+    args[0] = argv[2];
+    args[1] = "-l";
+    args[2] = argv[1];
+    daemon_args(args + 3, argv + 3, argc - 3);
+
+    int in, out, err;
+    const pid_t pid = spawn_daemon(args, &in, &out, &err);
+    FILE *errf      = fdopen(err, "r");
+
+    int i;
+    for (i = 0; i < TAPS; i++)
+        tap(in, KEY_A);
+    for (i = 0; i < J_TAPS; i++)
+        tap(in, KEY_J);
+    for (i = 0; i < J_HOLDS; i++) {
+        write_frame(in, KEY_J, 1, 0);
+        sleep_ns(THRESHOLD_NS + 30 * MS);
+        write_frame(in, KEY_J, 0, 0);
+    }
+    for (i = 0; i < CHORDS; i++) {
+        write_frame(in, KEY_J, 1, 0);
+        write_frame(in, KEY_K, 1, 0);
+        sleep_ns(5 * MS);
+        write_frame(in, KEY_J, 0, 0);
+        write_frame(in, KEY_K, 0, 0);
+        sleep_ns(MS);
+    }
+    // Late already when it arrives
+    write_frame(in, KEY_A, 1, 5 * budget_ms * MS);
+    write_frame(in, KEY_A, 0, 0);
+    sleep_ns(10 * MS);
+
+    struct class_stats pass = {0}, flushed = {0}, chord = {0};
+    unsigned long flagged = 0;
+    char line[512];
+    kill(pid, SIGUSR1);
+    while (fgets(line, sizeof(line), errf)) {
+        if (strstr(line, "over the") && !strncmp(line, "Key ", 4))
+            flagged++;
+        if (parse(line, "chord target", &chord))
+            break;
+        if (!parse(line, "passed through", &pass))
+            parse(line, "flushed", &flushed);
+    }
+    reap_daemon(pid, in, out);
+
+    print("passed through", &pass);
+    print("flushed", &flushed);
+    print("chord target", &chord);
+    printf("%lu passed through over the %.3fms budget, %lu flagged\n",
+           pass.over, budget_ms, flagged);
+
+    // A: press + release, J taps and holds: release, stale A: press + release
+    const bool ok =
+        pass.keys == 2 * TAPS + J_TAPS + J_HOLDS + 2 &&
+        flushed.keys == J_TAPS + J_HOLDS && chord.keys == 2 * CHORDS &&
+        flushed.max >= THRESHOLD_NS / 1e6 && pass.p99 < budget_ms &&
+        pass.over >= 1 && flagged >= 1;
+    if (!ok)
+        fprintf(stderr, "FAILED\n");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
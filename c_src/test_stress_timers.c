@@ -0,0 +1,211 @@
+#define _GNU_SOURCE
+#include <linux/input.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "daemon_harness.h"
+
+// Stress test for the timer handling of a filter (`simul_three.c`,
+// `simul_daemon -`, ...): fires RATE key sequences per second at it for
+// SECONDS seconds and checks what comes out:
+// - no key is pressed twice without a release in between (duplicate flush)
+// - no key is released that isn't down (lost flush)
+// - no key is left down at the end (stuck key)
+// - no key pressed while a source key was held comes out before that source
+//   key (reordered flush)
+// Sequences cycle through a J+K chord, a J tap released within the
+// threshold, a J tap interrupted by another key and (rarely) a J held past
+// the threshold so its timer actually fires.
+//
+// With `-i` it is interleaved typing instead: J (or K) followed by A (or S)
+// right around the threshold (+-2ms), so the source key's timer and the
+// flush by the next press race every time. Two key presses per sequence,
+// i.e. RATE 10 is 20 keys/s.
+//
+// usage: test_stress_timers [-i] RATE SECONDS FILTER [FILTER_ARGS...]
+
+#define HOLD_EVERY 200          // Every n-th sequence outlives the threshold
+#define HOLD_NS 60000000        // > SIMUL_THRESHOLD (50ms)
+#define MAX_SEQUENCE_FRAMES 4
+#define THRESHOLD_NS 50000000   // SIMUL_THRESHOLD
+#define JITTER_US 2000
+
+struct stress {
+    bool interleaved;
+    uint64_t rate;
+    uint64_t seconds;
+    int in_fd;
+    uint64_t sequences;
+    uint64_t presses;
+};
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void sleep_until(uint64_t t) {
+    struct timespec ts = {.tv_sec = t / 1000000000, .tv_nsec = t % 1000000000};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static void write_frame(int fd, uint16_t code, int32_t value) {
+    const struct input_event frame[] = {
+        {.type = EV_KEY, .code = code, .value = value},
+        {.type = EV_SYN, .code = SYN_REPORT, .value = 0},
+    };
+    if (write(fd, frame, sizeof(frame)) == -1)
+        err_exit("Failed on write");
+}
+
+// Source key, then another key pressed `THRESHOLD_NS +- JITTER_US` later,
+// swept in 1us steps
+static uint64_t write_interleaved(int fd, uint64_t i, uint64_t start,
+                                  uint64_t period) {
+    const uint16_t source = i % 2 ? KEY_K : KEY_J;
+    const uint16_t other  = i % 2 ? KEY_S : KEY_A;
+    const uint64_t at =
+        THRESHOLD_NS + ((i * 997) % (2 * JITTER_US)) * 1000 - JITTER_US * 1000;
+    sleep_until(start);
+    write_frame(fd, source, 1);
+    sleep_until(start + at);
+    write_frame(fd, other, 1);
+    write_frame(fd, source, 0);
+    write_frame(fd, other, 0);
+    return start + period;
+}
+
+// Frames of sequence `i`, spread evenly over `period`
+static uint64_t write_sequence(int fd, uint64_t i, uint64_t start,
+                               uint64_t period) {
+    const uint16_t chord[][2] = {
+        {KEY_J, 1}, {KEY_K, 1}, {KEY_K, 0}, {KEY_J, 0}};
+    const uint16_t tap[][2] = {{KEY_J, 1}, {KEY_J, 0}};
+    const uint16_t interrupted[][2] = {
+        {KEY_J, 1}, {KEY_A, 1}, {KEY_J, 0}, {KEY_A, 0}};
+    const uint16_t(*frames)[2];
+    size_t num_frames;
+    switch (i % 3) {
+        case 0:
+            frames = chord, num_frames = 4;
+            break;
+        case 1:
+            frames = tap, num_frames = 2;
+            break;
+        default:
+            frames = interrupted, num_frames = 4;
+            break;
+    }
+    size_t f;
+    for (f = 0; f < num_frames; f++) {
+        sleep_until(start + f * period / MAX_SEQUENCE_FRAMES);
+        write_frame(fd, frames[f][0], frames[f][1]);
+    }
+    if (i % HOLD_EVERY == HOLD_EVERY - 1) {
+        // Let the timer of a lone J fire
+        write_frame(fd, KEY_J, 1);
+        sleep_until(now_ns() + HOLD_NS);
+        write_frame(fd, KEY_J, 0);
+        return now_ns();
+    }
+    return start + period;
+}
+
+static void *writer(void *arg) {
+    struct stress *s     = arg;
+    const uint64_t end   = now_ns() + s->seconds * 1000000000;
+    const uint64_t period = 1000000000 / s->rate;
+    uint64_t start       = now_ns();
+    while (start < end) {
+        if (s->interleaved) {
+            start = write_interleaved(s->in_fd, s->sequences++, start, period);
+            s->presses += 2;
+        } else {
+            // Chord, tap, interrupted tap: 2, 1 and 2 presses
+            s->presses += s->sequences % 3 == 1 ? 1 : 2;
+            start = write_sequence(s->in_fd, s->sequences++, start, period);
+        }
+    }
+    // Give pending timers a chance to fire before closing
+    sleep_until(now_ns() + HOLD_NS);
+    close(s->in_fd);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    const bool interleaved = argc > 1 && !strcmp(argv[1], "-i");
+    argv += interleaved, argc -= interleaved;
+    if (argc < 4) {
+        fprintf(stderr,
+                "usage: %s [-i] RATE SECONDS FILTER [FILTER_ARGS...]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    struct stress s = {.interleaved = interleaved,
+                       .rate        = strtoull(argv[1], NULL, 10),
+                       .seconds     = strtoull(argv[2], NULL, 10)};
+    if (interleaved &&
+        1000000000 / s.rate < THRESHOLD_NS + JITTER_US * 1000) {
+        fprintf(stderr, "-i: at most %d sequences/s\n",
+                1000000000 / (THRESHOLD_NS + JITTER_US * 1000));
+        return EXIT_FAILURE;
+    }
+
+    int out;
+    const pid_t pid = spawn_daemon(argv + 3, &s.in_fd, &out, NULL);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, writer, &s) != 0)
+        err_exit("Failed on pthread_create");
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Check output
+    ////////////////////////////////////////////////////////////////////////////
+    static bool down[KEY_CNT];
+    uint64_t duplicates = 0, orphans = 0, reordered = 0, targets = 0;
+    uint64_t stuck = 0, written = 0;
+    struct input_event event;
+    size_t got = 0;
+    ssize_t n;
+    while ((n = read(out, (char *)&event + got, sizeof(event) - got)) > 0) {
+        got += n;
+        if (got < sizeof(event))
+            continue;
+        got = 0;
+        written++;
+        if (event.type != EV_KEY || event.code >= KEY_CNT)
+            continue;
+        if (event.value == 1) {
+            duplicates += down[event.code];
+            // A and S are only ever pressed while J respectively K is held
+            reordered += (event.code == KEY_A && !down[KEY_J]) ||
+                         (event.code == KEY_S && !down[KEY_K]);
+            down[event.code] = true;
+            targets += event.code == KEY_ESC;
+        } else if (event.value == 0) {
+            orphans += !down[event.code];
+            down[event.code] = false;
+        }
+    }
+    pthread_join(tid, NULL);
+    reap_daemon(pid, -1, out);
+    size_t code;
+    for (code = 0; code < KEY_CNT; code++)
+        stuck += down[code];
+
+    const uint64_t chords = s.interleaved ? 0 : (s.sequences + 2) / 3;
+    printf("%lu sequences (%lu keys/s), targets %lu/%lu, events written %lu, "
+           "duplicate presses %lu, orphan releases %lu, reordered %lu, stuck "
+           "keys %lu\n",
+           s.sequences, s.presses / s.seconds, targets, chords, written,
+           duplicates, orphans, reordered, stuck);
+    return duplicates || orphans || reordered || stuck ? EXIT_FAILURE
+                                                       : EXIT_SUCCESS;
+}
@@ -0,0 +1,491 @@
+#define _GNU_SOURCE
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "evbatch.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// APPLICATION CONSTANTS
+////////////////////////////////////////////////////////////////////////////////
+#define DROP_BYTES (64 << 20)  // Give back replayed pages every 64MB
+#define SNIFF_BYTES 64
+#define MAX_LINE 256
+
+////////////////////////////////////////////////////////////////////////////////
+// TRACE FILES
+////////////////////////////////////////////////////////////////////////////////
+// evtest captures are plain text, binary dumps start with a `timeval`
+static enum trace_format sniff_format(const char *map, size_t size) {
+    size_t i;
+    for (i = 0; i < size && i < SNIFF_BYTES; i++) {
+        const unsigned char c = map[i];
+        if ((c < 0x20 || c > 0x7e) && c != '\n' && c != '\t' && c != '\r')
+            return TRACE_BINARY;
+    }
+    return size ? TRACE_EVTEST : TRACE_BINARY;
+}
+
+int trace_open(struct trace *t, const char *path) {
+    memset(t, 0, offsetof(struct trace, buf));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    t->size = st.st_size;
+    if (t->size) {
+        t->map = mmap(NULL, t->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (t->map == MAP_FAILED) {
+            close(fd);
+            t->map = NULL;
+            return -1;
+        }
+        madvise((void *)t->map, t->size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    t->format = sniff_format(t->map, t->size);
+    return 0;
+}
+
+void trace_close(struct trace *t) {
+    if (t->map)
+        munmap((void *)t->map, t->size);
+    t->map = NULL;
+}
+
+// Everything before `pos` has been replayed, drop those pages so a multi-GB
+// trace doesn't pile up in our resident set
+static void drop_replayed(struct trace *t) {
+    const size_t page = 4096;
+    const size_t upto = t->pos / page * page;
+    if (upto - t->dropped < DROP_BYTES)
+        return;
+    madvise((void *)(t->map + t->dropped), upto - t->dropped, MADV_DONTNEED);
+    t->dropped = upto;
+}
+
+static bool skip_past(const char **p, const char *end, const char *s) {
+    const size_t len = strlen(s);
+    const char *at   = memmem(*p, end - *p, s, len);
+    if (!at)
+        return false;
+    *p = at + len;
+    return true;
+}
+
+static bool parse_num(const char **p, const char *end, int base,
+                      uint64_t *value) {
+    char tmp[32];
+    size_t len = 0;
+    while (*p + len < end && len < sizeof(tmp) - 1 && (*p)[len] != ',' &&
+           (*p)[len] != ' ' && (*p)[len] != '.' && (*p)[len] != '\r')
+        len++;
+    if (!len)
+        return false;
+    memcpy(tmp, *p, len);
+    tmp[len] = '\0';
+    char *stop;
+    *value = strtoull(tmp, &stop, base);
+    *p += len;
+    return *stop == '\0';
+}
+
+// "Event: time 1636573150.762037, type 4 (EV_MSC), code 4 (MSC_SCAN), value 1c"
+// "Event: time 1636573150.762037, -------------- SYN_REPORT ------------"
+static bool parse_evtest_line(const char *p, const char *end,
+                              struct input_event *ev) {
+    uint64_t sec, usec, type, code, value;
+    if (end - p > MAX_LINE || !skip_past(&p, end, "Event: time ") ||
+        !parse_num(&p, end, 10, &sec) || p == end || *p++ != '.' ||
+        !parse_num(&p, end, 10, &usec))
+        return false;
+    ev->time.tv_sec  = sec;
+    ev->time.tv_usec = usec;
+    if (skip_past(&p, end, "-------------- ")) {
+        ev->type  = EV_SYN;
+        ev->code  = memmem(p, end - p, "SYN_DROPPED", 11) ? SYN_DROPPED
+                                                           : SYN_REPORT;
+        ev->value = 0;
+        return true;
+    }
+    if (!skip_past(&p, end, "type ") || !parse_num(&p, end, 10, &type) ||
+        !skip_past(&p, end, "code ") || !parse_num(&p, end, 10, &code) ||
+        !skip_past(&p, end, "value "))
+        return false;
+    // evtest prints MSC values (scan codes) in hex
+    if (p < end && *p == '-') {
+        p++;
+        if (!parse_num(&p, end, 10, &value))
+            return false;
+        value = -value;
+    } else if (!parse_num(&p, end, type == EV_MSC ? 16 : 10, &value)) {
+        return false;
+    }
+    ev->type  = type;
+    ev->code  = code;
+    ev->value = value;
+    return true;
+}
+
+const struct input_event *trace_chunk(struct trace *t, size_t *count) {
+    drop_replayed(t);
+    if (t->format == TRACE_BINARY) {
+        size_t n = (t->size - t->pos) / sizeof(struct input_event);
+        if (n > TRACE_CHUNK_EVENTS)
+            n = TRACE_CHUNK_EVENTS;
+        const struct input_event *events =
+            (const struct input_event *)(t->map + t->pos);
+        t->pos += n * sizeof(struct input_event);
+        *count = n;
+        return n ? events : NULL;
+    }
+    size_t n = 0;
+    while (n < TRACE_CHUNK_EVENTS && t->pos < t->size) {
+        const char *line = t->map + t->pos;
+        const char *eol  = memchr(line, '\n', t->size - t->pos);
+        if (!eol)
+            eol = t->map + t->size;
+        t->pos = eol - t->map + 1;
+        if (parse_evtest_line(line, eol, &t->buf[n]))
+            n++;
+    }
+    if (t->pos > t->size)
+        t->pos = t->size;
+    *count = n;
+    return n ? t->buf : NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// STATS
+////////////////////////////////////////////////////////////////////////////////
+uint64_t trace_hist_quantile(const struct trace_hist *h, unsigned per_mille) {
+    if (!h->count)
+        return 0;
+    const uint64_t rank = (h->count * per_mille + 999) / 1000;
+    uint64_t seen       = 0;
+    size_t b;
+    for (b = 0; b < TRACE_HIST_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank && seen)
+            break;
+    }
+    const uint64_t edge = (b + 1) * (uint64_t)TRACE_HIST_BUCKET_NS;
+    return edge < h->max_ns ? edge : h->max_ns;
+}
+
+void trace_hist_merge(struct trace_hist *dst, const struct trace_hist *src) {
+    size_t b;
+    for (b = 0; b < TRACE_HIST_BUCKETS; b++)
+        dst->buckets[b] += src->buckets[b];
+    dst->count += src->count;
+    dst->sum_ns += src->sum_ns;
+    if (src->max_ns > dst->max_ns)
+        dst->max_ns = src->max_ns;
+}
+
+void trace_stats_merge(struct trace_stats *dst, const struct trace_stats *src) {
+    dst->events_in += src->events_in;
+    dst->events_out += src->events_out;
+    dst->duration_ns += src->duration_ns;
+    if (src->num_rules > dst->num_rules)
+        dst->num_rules = src->num_rules;
+    size_t r;
+    for (r = 0; r < src->num_rules; r++) {
+        dst->rules[r].attempts += src->rules[r].attempts;
+        dst->rules[r].chords += src->rules[r].chords;
+        dst->rules[r].accidental += src->rules[r].accidental;
+        trace_hist_merge(&dst->rules[r].delay, &src->rules[r].delay);
+    }
+}
+
+void trace_stats_print(const struct trace_stats *stats,
+                       const struct chord_config *cfg, FILE *f) {
+    fprintf(f, "events in %lu, out %lu, %.1fs of input, threshold %.1fms\n",
+            stats->events_in, stats->events_out, stats->duration_ns / 1e9,
+            cfg->threshold_ns / 1e6);
+    size_t r, s;
+    for (r = 0; r < stats->num_rules; r++) {
+        const struct trace_rule_stats *rs = &stats->rules[r];
+        const struct trace_hist *d        = &rs->delay;
+        fprintf(f, "rule %zu (", r);
+        for (s = 0; s < cfg->rules[r].num_sources; s++)
+            fprintf(f, "%s%u", s ? "+" : "", cfg->rules[r].sources[s]);
+        fprintf(f,
+                " -> %u): attempts %lu, chords %lu (%.1f%%), accidental %lu\n"
+                "    delay: %lu presses, mean %.2fms, p50 %.2fms, p99 %.2fms, "
+                "max %.2fms\n",
+                cfg->rules[r].target, rs->attempts, rs->chords,
+                rs->attempts ? 100.0 * rs->chords / rs->attempts : 0.0,
+                rs->accidental, d->count,
+                d->count ? d->sum_ns / 1e6 / d->count : 0.0,
+                trace_hist_quantile(d, 500) / 1e6,
+                trace_hist_quantile(d, 990) / 1e6, d->max_ns / 1e6);
+    }
+}
+
+// Quoted only when needed (RFC 4180)
+static void csv_string(const char *s, FILE *f) {
+    if (!strpbrk(s, ",\"\r\n")) {
+        fputs(s, f);
+        return;
+    }
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"')
+            fputc('"', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static void json_string(const char *s, FILE *f) {
+    fputc('"', f);
+    for (; *s; s++) {
+        const unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+void trace_stats_csv_header(FILE *f) {
+    fputs("file,threshold_ms,rule,sources,target,events_in,events_out,"
+          "duration_s,attempts,chords,hit_rate,accidental,delay_count,"
+          "delay_mean_ms,delay_p50_ms,delay_p99_ms,delay_max_ms\n",
+          f);
+}
+
+void trace_stats_csv(const struct trace_stats *stats,
+                     const struct chord_config *cfg, const char *name,
+                     FILE *f) {
+    size_t r, s;
+    for (r = 0; r < stats->num_rules; r++) {
+        const struct trace_rule_stats *rs = &stats->rules[r];
+        const struct trace_hist *d        = &rs->delay;
+        if (name)
+            csv_string(name, f);
+        fprintf(f, ",%.1f,%zu,", cfg->threshold_ns / 1e6, r);
+        for (s = 0; s < cfg->rules[r].num_sources; s++)
+            fprintf(f, "%s%u", s ? "+" : "", cfg->rules[r].sources[s]);
+        fprintf(f, ",%u,%lu,%lu,%.3f,%lu,%lu,%.4f,%lu,%lu,%.3f,%.3f,%.3f,%.3f\n",
+                cfg->rules[r].target, stats->events_in, stats->events_out,
+                stats->duration_ns / 1e9, rs->attempts, rs->chords,
+                rs->attempts ? (double)rs->chords / rs->attempts : 0.0,
+                rs->accidental, d->count,
+                d->count ? d->sum_ns / 1e6 / d->count : 0.0,
+                trace_hist_quantile(d, 500) / 1e6,
+                trace_hist_quantile(d, 990) / 1e6, d->max_ns / 1e6);
+    }
+}
+
+void trace_stats_json(const struct trace_stats *stats,
+                      const struct chord_config *cfg, const char *name,
+                      bool histogram, FILE *f) {
+    fputc('{', f);
+    if (name) {
+        fputs("\"file\": ", f);
+        json_string(name, f);
+        fputs(", ", f);
+    }
+    fprintf(f,
+            "\"threshold_ms\": %.1f, \"events_in\": %lu, \"events_out\": %lu, "
+            "\"duration_s\": %.3f, \"rules\": [",
+            cfg->threshold_ns / 1e6, stats->events_in, stats->events_out,
+            stats->duration_ns / 1e9);
+    size_t r, s, b;
+    for (r = 0; r < stats->num_rules; r++) {
+        const struct trace_rule_stats *rs = &stats->rules[r];
+        const struct trace_hist *d        = &rs->delay;
+        fprintf(f, "%s{\"sources\": [", r ? ", " : "");
+        for (s = 0; s < cfg->rules[r].num_sources; s++)
+            fprintf(f, "%s%u", s ? ", " : "", cfg->rules[r].sources[s]);
+        fprintf(f,
+                "], \"target\": %u, \"attempts\": %lu, \"chords\": %lu, "
+                "\"hit_rate\": %.4f, \"accidental\": %lu, \"delay\": "
+                "{\"count\": %lu, \"mean_ms\": %.3f, \"p50_ms\": %.3f, "
+                "\"p99_ms\": %.3f, \"max_ms\": %.3f",
+                cfg->rules[r].target, rs->attempts, rs->chords,
+                rs->attempts ? (double)rs->chords / rs->attempts : 0.0,
+                rs->accidental, d->count,
+                d->count ? d->sum_ns / 1e6 / d->count : 0.0,
+                trace_hist_quantile(d, 500) / 1e6,
+                trace_hist_quantile(d, 990) / 1e6, d->max_ns / 1e6);
+        if (histogram) {
+            // [upper edge in ms, count] of every non-empty bucket
+            bool first = true;
+            fputs(", \"histogram\": [", f);
+            for (b = 0; b < TRACE_HIST_BUCKETS; b++) {
+                if (!d->buckets[b])
+                    continue;
+                fprintf(f, "%s[%.1f, %lu]", first ? "" : ", ",
+                        (b + 1) * TRACE_HIST_BUCKET_NS / 1e6, d->buckets[b]);
+                first = false;
+            }
+            fputc(']', f);
+        }
+        fputs("}}", f);
+    }
+    fputs("]}", f);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// REPLAY
+////////////////////////////////////////////////////////////////////////////////
+static inline uint64_t event_ns(const struct input_event *ev) {
+    return (uint64_t)ev->time.tv_sec * 1000000000 + ev->time.tv_usec * 1000;
+}
+
+void trace_run_init(struct trace_run *run, const struct chord_config *cfg,
+                    int out_fd) {
+    memset(run, 0, offsetof(struct trace_run, out));
+    run->cfg              = cfg;
+    run->out_fd           = out_fd;
+    run->first_ns         = UINT64_MAX;
+    run->last_other_press = UINT64_MAX;
+    run->stats.num_rules  = cfg->num_rules;
+    chord_state_init(&run->st);
+}
+
+static void flush_out(struct trace_run *run) {
+    const char *buf = (const char *)run->out;
+    size_t left     = run->num_out * sizeof(struct input_event);
+    while (run->out_fd != -1 && left) {
+        ssize_t n = write(run->out_fd, buf, left);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("Failed on write");
+            exit(EXIT_FAILURE);
+        }
+        buf += n;
+        left -= n;
+    }
+    run->num_out = 0;
+}
+
+// Bookkeeping for `n` events the engine just wrote at `now`
+static void account_out(struct trace_run *run, uint64_t now, size_t n) {
+    const struct input_event *out = run->out + run->num_out;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        // Every source key press written as itself was held back
+        if (out[i].type != EV_KEY || out[i].value != 1 ||
+            !chord_is_source_key(run->cfg, out[i].code))
+            continue;
+        const uint8_t r = run->cfg->rule_of[out[i].code];
+        trace_hist_add(&run->stats.rules[r].delay,
+                       now - run->pressed_at[out[i].code]);
+    }
+    run->num_out += n;
+    run->stats.events_out += n;
+    if (run->num_out >= TRACE_CHUNK_EVENTS)
+        flush_out(run);
+}
+
+static void expire_until(struct trace_run *run, uint64_t t) {
+    uint64_t deadline;
+    while ((deadline = chord_next_deadline(&run->st)) <= t)
+        account_out(run, deadline,
+                    chord_expire(run->cfg, &run->st, deadline,
+                                 run->out + run->num_out));
+}
+
+// Input side bookkeeping of a key event at `t`
+static void account_in(struct trace_run *run, const struct input_event *ev,
+                       uint64_t t) {
+    const struct chord_config *cfg = run->cfg;
+    if (!chord_is_source_key(cfg, ev->code)) {
+        if (ev->value == 1)
+            run->last_other_press = t;
+        return;
+    }
+    const uint8_t r   = cfg->rule_of[ev->code];
+    const uint8_t bit = 1 << cfg->bit_of[ev->code];
+    if (ev->value == 1) {
+        run->pressed_at[ev->code] = t;
+        run->sources_down[r] |= bit;
+        if (run->sources_down[r] == (1 << cfg->rules[r].num_sources) - 1)
+            run->stats.rules[r].attempts++;
+    } else if (ev->value == 0) {
+        run->sources_down[r] &= ~bit;
+    }
+}
+
+// A chord of rule `r` just fired, its first source press started it
+static void account_chord(struct trace_run *run, uint8_t r) {
+    const struct chord_rule *rule = &run->cfg->rules[r];
+    uint64_t start                = UINT64_MAX;
+    size_t s;
+    for (s = 0; s < rule->num_sources; s++)
+        if (run->pressed_at[rule->sources[s]] < start)
+            start = run->pressed_at[rule->sources[s]];
+    run->stats.rules[r].chords++;
+    if (run->last_other_press != UINT64_MAX &&
+        run->last_other_press <= start &&
+        start - run->last_other_press < TRACE_BURST_NS)
+        run->stats.rules[r].accidental++;
+}
+
+void trace_run_feed(struct trace_run *run, const struct input_event *events,
+                    size_t count) {
+    const struct chord_config *cfg = run->cfg;
+    size_t i                       = 0;
+    if (count) {
+        if (run->first_ns == UINT64_MAX)
+            run->first_ns = event_ns(&events[0]);
+        run->last_ns = event_ns(&events[count - 1]);
+    }
+    run->stats.events_in += count;
+    while (i < count) {
+        const struct input_event *ev = &events[i];
+        const uint64_t t             = event_ns(ev);
+        expire_until(run, t);
+
+        // Nothing held back: runs of non-key events go through unchanged
+        if (!run->st.num_pending && ev->type != EV_KEY) {
+            size_t run_len = evbatch_skip_non_key(ev, count - i);
+            const size_t room =
+                TRACE_CHUNK_EVENTS + CHORD_MAX_OUT - run->num_out;
+            if (run_len > room)
+                run_len = room;
+            memcpy(run->out + run->num_out, ev, run_len * sizeof(*ev));
+            account_out(run, t, run_len);
+            i += run_len;
+            continue;
+        }
+        if (ev->type == EV_KEY)
+            account_in(run, ev, t);
+
+        uint8_t was_down = 0;
+        size_t r;
+        for (r = 0; r < cfg->num_rules; r++)
+            was_down |= run->st.rules[r].target_down << r;
+        account_out(run, t,
+                    chord_feed(cfg, &run->st, ev, t, run->out + run->num_out));
+        for (r = 0; r < cfg->num_rules; r++)
+            if (run->st.rules[r].target_down && !(was_down & 1 << r))
+                account_chord(run, r);
+        i++;
+    }
+}
+
+void trace_run_finish(struct trace_run *run) {
+    expire_until(run, CHORD_NO_DEADLINE - 1);
+    flush_out(run);
+    if (run->first_ns != UINT64_MAX)
+        run->stats.duration_ns = run->last_ns - run->first_ns;
+}
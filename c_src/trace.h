@@ -0,0 +1,135 @@
+#ifndef SIMUL_TRACE_H
+#define SIMUL_TRACE_H
+
+#include <linux/input.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chord.h"
+
+// Offline replay of recorded event traces through the chord engine, on the
+// trace's own (virtual) clock: deadlines are expired exactly when they come
+// due between two recorded events, so a multi-GB capture replays as fast as
+// the CPU allows and gives the same output the live filter would have.
+//
+// Two trace formats are read:
+// - binary `input_event` dumps (what `intercept` writes, `cat /dev/input/...`)
+// - `evtest` text captures (see `evtest-output.txt`)
+// Both are streamed through `mmap` (MADV_SEQUENTIAL), pages already replayed
+// are dropped again, so memory use doesn't grow with the trace.
+
+////////////////////////////////////////////////////////////////////////////////
+// LIMITS
+////////////////////////////////////////////////////////////////////////////////
+#define TRACE_CHUNK_EVENTS 4096
+#define TRACE_HIST_BUCKETS 4096
+#define TRACE_HIST_BUCKET_NS 100000  // 0.1ms, up to 409.6ms
+// A chord fired less than this after another key press is counted as
+// accidental: it was most likely a roll inside a typing burst
+#define TRACE_BURST_NS 250000000
+
+////////////////////////////////////////////////////////////////////////////////
+// TRACE FILES
+////////////////////////////////////////////////////////////////////////////////
+enum trace_format { TRACE_BINARY, TRACE_EVTEST };
+
+struct trace {
+    enum trace_format format;
+    const char *map;
+    size_t size;
+    size_t pos;
+    size_t dropped;  // Everything before this has been given back
+    struct input_event buf[TRACE_CHUNK_EVENTS];  // Decoded text events
+};
+
+// -1 (errno set) if the file can't be mapped
+int trace_open(struct trace *t, const char *path);
+void trace_close(struct trace *t);
+
+// Next chunk of events (at most TRACE_CHUNK_EVENTS), NULL at the end. Binary
+// traces are returned straight from the mapping, no copy.
+const struct input_event *trace_chunk(struct trace *t, size_t *count);
+
+////////////////////////////////////////////////////////////////////////////////
+// STATS
+////////////////////////////////////////////////////////////////////////////////
+struct trace_hist {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[TRACE_HIST_BUCKETS];  // Last one takes everything above
+};
+
+struct trace_rule_stats {
+    uint64_t attempts;    // Times all source keys were down at once
+    uint64_t chords;      // Times the target got pressed
+    uint64_t accidental;  // Chords fired within TRACE_BURST_NS of another key
+    // Delay added to source key presses that were written as themselves
+    // (i.e. normal typing), from the recorded press until it was written
+    struct trace_hist delay;
+};
+
+struct trace_stats {
+    uint64_t events_in;
+    uint64_t events_out;
+    uint64_t duration_ns;  // From first to last recorded event
+    uint8_t num_rules;
+    struct trace_rule_stats rules[CHORD_MAX_RULES];
+};
+
+static inline void trace_hist_add(struct trace_hist *h, uint64_t ns) {
+    size_t b = ns / TRACE_HIST_BUCKET_NS;
+    if (b >= TRACE_HIST_BUCKETS)
+        b = TRACE_HIST_BUCKETS - 1;
+    h->buckets[b]++;
+    h->count++;
+    h->sum_ns += ns;
+    if (ns > h->max_ns)
+        h->max_ns = ns;
+}
+
+// Upper edge of the bucket holding the `per_mille`th value, 0 if empty
+uint64_t trace_hist_quantile(const struct trace_hist *h, unsigned per_mille);
+void trace_hist_merge(struct trace_hist *dst, const struct trace_hist *src);
+void trace_stats_merge(struct trace_stats *dst, const struct trace_stats *src);
+void trace_stats_print(const struct trace_stats *stats,
+                       const struct chord_config *cfg, FILE *f);
+// Exports for dashboards: one CSV row per rule, or one JSON object for the
+// whole trace. `name` (NULL to leave it out) identifies the trace, JSON
+// objects also carry the non-empty delay buckets if `histogram` is set.
+void trace_stats_csv_header(FILE *f);
+void trace_stats_csv(const struct trace_stats *stats,
+                     const struct chord_config *cfg, const char *name,
+                     FILE *f);
+void trace_stats_json(const struct trace_stats *stats,
+                      const struct chord_config *cfg, const char *name,
+                      bool histogram, FILE *f);
+
+////////////////////////////////////////////////////////////////////////////////
+// REPLAY
+////////////////////////////////////////////////////////////////////////////////
+// One engine instance replaying one trace, `out_fd` gets the transformed
+// stream (-1 to only collect stats)
+struct trace_run {
+    const struct chord_config *cfg;
+    struct chord_state st;
+    struct trace_stats stats;
+    int out_fd;
+    uint64_t first_ns, last_ns;
+    uint64_t last_other_press;  // Last non-source key press, for `accidental`
+    uint8_t sources_down[CHORD_MAX_RULES];
+    uint64_t pressed_at[KEY_CNT];  // Recorded time of source key presses
+    size_t num_out;
+    struct input_event out[TRACE_CHUNK_EVENTS + CHORD_MAX_OUT];
+};
+
+void trace_run_init(struct trace_run *run, const struct chord_config *cfg,
+                    int out_fd);
+void trace_run_feed(struct trace_run *run, const struct input_event *events,
+                    size_t count);
+// End of trace: writes whatever is still held back and flushes the output
+void trace_run_finish(struct trace_run *run);
+
+#endif
@@ -0,0 +1,51 @@
+#!/bin/sh
+
+# Input devices, one daemon grabs all of them (globs are allowed, quote them!)
+# and keeps watching for matching devices being plugged in later on
+DEVNODES='/dev/input/by-id/*-event-kbd'
+# Add `-m` to allow chords across devices (e.g. split keyboards)
+DAEMON_FLAGS=''
+# Set to '-DSIMUL_STATIC_RULES' to compile the rules of `chord_rules.h` into the
+# engine instead of looking them up at runtime
+BUILD_FLAGS=''
+# Chord rules as key codes (see `c_src/simul_keymap.c`), e.g. '36+37=1' for
+# J+K -> ESC. They are compiled into a keymap image that the daemon maps at
+# start up, so changing them needs no rebuild (not with SIMUL_STATIC_RULES).
+# Empty: the rules of `chord_rules.h`
+KEYMAP_RULES=''
+KEYMAP_THRESHOLD_MS='50'
+# `uinput` needs existing devices to copy the capabilities from
+UINPUT_DEVNODE='/dev/input/by-id/usb-Apple_Inc._Apple_Internal_Keyboard___Trackpad_D3H82120G61F-if01-event-kbd'
+
+# Files
+src_daemon="c_src/simul_daemon.c c_src/chord.c"
+out_daemon="out_simul_daemon"
+src_daemon="$src_daemon c_src/keymap.c"
+src_keymap="c_src/simul_keymap.c c_src/chord.c c_src/keymap.c"
+out_keymap="out_simul_keymap"
+src_hyper="c_src/hyper.c"
+out_hyper="out_hyper"
+
+# Only rebuild what is out of date, so a restart is just a restart
+outdated() {
+    [ ! -x "$1" ] || [ -n "$(find c_src "$0" -newer "$1")" ]
+}
+
+# Build and run
+if outdated $out_daemon; then
+    gcc -O2 $BUILD_FLAGS $src_daemon -lpthread -o $out_daemon || exit 1
+fi
+if outdated $out_hyper; then
+    gcc $src_hyper -o $out_hyper || exit 1
+fi
+if [ -n "$KEYMAP_RULES" ]; then
+    if outdated $out_keymap; then
+        gcc -O2 $src_keymap -o $out_keymap || exit 1
+    fi
+    ./"$out_keymap" -t $KEYMAP_THRESHOLD_MS out_keymap.bin $KEYMAP_RULES \
+        || exit 1
+    DAEMON_FLAGS="$DAEMON_FLAGS -k out_keymap.bin"
+fi
+sudo nice -n -20 ./"$out_daemon" $DAEMON_FLAGS "$DEVNODES" \
+    | ./"$out_hyper" \
+    | sudo nice -n -20 uinput -d $UINPUT_DEVNODE
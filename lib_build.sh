@@ -0,0 +1,13 @@
+#!/bin/sh
+
+# Build libsimulkeys (`c_src/simulkeys.h`) as a static and a shared library
+
+# Files
+out_lib="out_libsimulkeys"
+
+# Build
+gcc -O2 -fPIC -c c_src/simulkeys.c -o "$out_lib"_simulkeys.o && \
+gcc -O2 -fPIC -c c_src/chord.c -o "$out_lib"_chord.o && \
+ar rcs "$out_lib".a "$out_lib"_simulkeys.o "$out_lib"_chord.o && \
+gcc -shared "$out_lib"_simulkeys.o "$out_lib"_chord.o -o "$out_lib".so && \
+rm "$out_lib"_simulkeys.o "$out_lib"_chord.o
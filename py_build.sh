@@ -0,0 +1,11 @@
+#!/bin/sh
+
+# Build the `simulkeys` CPython extension (native chord engine) into `py_src`,
+# next to the scripts importing it
+
+# Files
+src_ext="c_src/simulkeysmodule.c c_src/simulkeys.c c_src/chord.c"
+out_ext="py_src/simulkeys$(python3-config --extension-suffix)"
+
+# Build
+gcc -O2 -shared -fPIC $(python3-config --includes) $src_ext -o "$out_ext"
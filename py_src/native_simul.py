@@ -0,0 +1,45 @@
+import os
+import select
+import sys
+
+import simulkeys
+from config import INPUT_EVENT_SIZE, SOURCE_KEYS, TARGET_KEY, THRESHOLD_SEC
+
+# Same filter as `select_simul_three.py`, but the chord logic runs in the
+# native engine (`c_src/simulkeysmodule.c`, build it with `./py_build.sh`).
+# Python only reads whole buffers from stdin, hands them over and writes
+# back whatever comes out, there is no per-event work left in here.
+
+################################################################################
+# APPLICATION CONSTANTS
+################################################################################
+READ_SIZE = 64 * INPUT_EVENT_SIZE
+
+
+def main():
+    engine = simulkeys.Engine(
+        rules=[(SOURCE_KEYS, TARGET_KEY)], threshold=THRESHOLD_SEC
+    )
+    stdin = sys.stdin.fileno()
+    stdout = sys.stdout.buffer
+
+    while True:
+        # Blocks until input arrives or the oldest held back press is due
+        rlist, _, _ = select.select([stdin], [], [], engine.timeout())
+        if not rlist:
+            stdout.write(engine.on_deadline())
+            stdout.flush()
+            continue
+        data = os.read(stdin, READ_SIZE)
+        if not data:
+            break
+        stdout.write(engine.feed(data))
+        stdout.flush()
+
+    # Stdin closed, write what's held back and release any target still down
+    stdout.write(engine.on_deadline(2**64 - 1) + engine.reset())
+    stdout.flush()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,20 @@
+#!/bin/sh
+
+# Stall the daemon's consumer while typing (with repeats) and moving the
+# pointer, then check that no key press or release got lost and that the
+# daemon answered meanwhile. Single and two thread mode, non-key events
+# dropped and kept. Pass a stall in ms for something other than 2s.
+
+# Files
+src_daemon="c_src/simul_daemon.c c_src/chord.c c_src/keymap.c"
+out_daemon="out_simul_daemon"
+src_backpressure="c_src/test_backpressure.c"
+out_backpressure="out_test_backpressure"
+stall_ms="${1:-2000}"
+
+# Build and run
+gcc -O2 $src_daemon -lpthread -o $out_daemon && \
+gcc -O2 $src_backpressure -o $out_backpressure && \
+./"$out_backpressure" "$stall_ms" ./"$out_daemon" && \
+./"$out_backpressure" "$stall_ms" ./"$out_daemon" -t && \
+./"$out_backpressure" "$stall_ms" ./"$out_daemon" -p keep
@@ -0,0 +1,14 @@
+#!/bin/sh
+
+# Drive the chord engine with random key streams on a virtual clock and check
+# its invariants, reports the engine's throughput as well. With clang around,
+# `clang -fsanitize=fuzzer,address -DSIMUL_LIBFUZZER $src_fuzz` builds the
+# same checks as a libFuzzer target.
+
+# Files
+src_fuzz="c_src/test_fuzz_chord.c c_src/chord.c"
+out_fuzz="out_test_fuzz_chord"
+
+# Build and run
+gcc -O2 $src_fuzz -o $out_fuzz && \
+./"$out_fuzz"
@@ -0,0 +1,18 @@
+#!/bin/sh
+
+# Type a little, then check that the daemon doesn't wake up once over a
+# minute of idling (wakeup counters and context switches), single and two
+# thread mode. Pass a number of seconds to idle for something shorter.
+
+# Files
+src_daemon="c_src/simul_daemon.c c_src/chord.c c_src/keymap.c"
+out_daemon="out_simul_daemon"
+src_idle="c_src/test_idle.c"
+out_idle="out_test_idle"
+seconds="${1:-60}"
+
+# Build and run
+gcc -O2 $src_daemon -lpthread -o $out_daemon && \
+gcc -O2 $src_idle -o $out_idle && \
+./"$out_idle" "$seconds" ./"$out_daemon" && \
+./"$out_idle" "$seconds" ./"$out_daemon" -t
@@ -0,0 +1,19 @@
+#!/bin/sh
+
+# Type on the daemon's stdin with kernel-like timestamps and check what its
+# latency self-test (`-l`) reports: every key in the right histogram, passed
+# through keys within the budget and a late one flagged. Single and two
+# thread mode. Pass a budget in us for something other than 1ms.
+
+# Files
+src_daemon="c_src/simul_daemon.c c_src/chord.c c_src/keymap.c"
+out_daemon="out_simul_daemon"
+src_latency="c_src/test_latency.c"
+out_latency="out_test_latency"
+budget_us="${1:-1000}"
+
+# Build and run
+gcc -O2 $src_daemon -lpthread -o $out_daemon && \
+gcc -O2 $src_latency -o $out_latency && \
+./"$out_latency" "$budget_us" ./"$out_daemon" && \
+./"$out_latency" "$budget_us" ./"$out_daemon" -t
@@ -0,0 +1,23 @@
+#!/bin/sh
+
+# Fire thousands of key sequences per second through the filters and check
+# for duplicate, lost and stuck keys, then interleaved typing at 32 keys/s
+# with every next key landing right at the threshold, to race the timers
+# (no devices or root needed)
+
+# Files
+src_simul_three="c_src/simul_three.c"
+out_simul_three="out_simul_three"
+src_simul_filter="c_src/simul_filter.c c_src/simulkeys.c c_src/chord.c"
+out_simul_filter="out_simul_filter"
+src_stress="c_src/test_stress_timers.c"
+out_stress="out_test_stress_timers"
+
+# Build and run
+gcc -O2 $src_simul_three -lrt -lpthread -o $out_simul_three && \
+gcc -O2 $src_stress -lpthread -o $out_stress && \
+./"$out_stress" 5000 5 ./"$out_simul_three" && \
+./"$out_stress" -i 16 10 ./"$out_simul_three" && \
+gcc -O2 $src_simul_filter -o $out_simul_filter && \
+./"$out_stress" 5000 5 ./"$out_simul_filter" && \
+./"$out_stress" -i 16 10 ./"$out_simul_filter"
@@ -0,0 +1,23 @@
+#!/bin/sh
+
+# Replay a recorded trace offline and print per rule stats, e.g.
+#     ./trace_build_run.sh evtest-output.txt
+#     ./trace_build_run.sh -t 80 -o out.bin capture.bin
+#     ./trace_build_run.sh -g 10:200:10 capture.bin
+#     ./trace_build_run.sh -f json captures/ > fleet.json
+# Without arguments an hour of synthetic typing is generated and replayed.
+
+# Files
+src_trace="c_src/simul_trace.c c_src/trace.c c_src/chord.c"
+out_trace="out_simul_trace"
+src_gen="c_src/gen_trace.c"
+out_gen="out_gen_trace"
+
+# Build and run
+gcc -O2 $src_trace -lpthread -o $out_trace || exit 1
+if [ $# -eq 0 ]; then
+    gcc -O2 $src_gen -o $out_gen && \
+    ./"$out_gen" 3600 > out_trace.bin && \
+    set -- out_trace.bin
+fi
+./"$out_trace" "$@"